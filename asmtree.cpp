@@ -1,12 +1,23 @@
+#include <cstdint>
 #include <string>
 #include <variant>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <atomic>
+#include <thread>
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <functional>
+#include <tuple>
+#include <iterator>
 #include "tac.hpp"
 #include "asmtree.hpp"
+#include "passes.hpp"
+#include "profile.hpp"
+#include "cfg.hpp"
 
 ASMTree::Imm::Imm(int val) : val(val) {}
 
@@ -16,15 +27,50 @@ ASMTree::Pseudo::Pseudo(std::string identifier) : identifier(std::move(identifie
 
 ASMTree::Stack::Stack(int offset) : offset(offset) {}
 
-ASMTree::AllocateStack::AllocateStack(int amount) : amount(amount) {}
+ASMTree::AllocateStack::AllocateStack(int amount, Location loc) : amount(amount), loc(loc) {}
 
-ASMTree::Unary::Unary(ASMTree::Unary::UnOp op, ASMTree::Operand operand) : op(op), operand(std::move(operand)) {}
+ASMTree::Unary::Unary(ASMTree::Unary::UnOp op, ASMTree::Operand operand, Location loc) : 
+    op(op), operand(std::move(operand)), loc(loc) {}
 
-ASMTree::Mov::Mov(ASMTree::Operand src, ASMTree::Operand dst) : src(std::move(src)), dst(std::move(dst)) {}
+ASMTree::Binary::Binary(ASMTree::Binary::BinOp op, ASMTree::Operand src, ASMTree::Operand dst, Location loc) : 
+    op(op), src(std::move(src)), dst(std::move(dst)), loc(loc) {}
 
-ASMTree::Function::Function(std::string identifier) : identifier(std::move(identifier)) {}
+ASMTree::Lea::Lea(ASMTree::Operand base, ASMTree::Operand index, int scale, int disp, ASMTree::Operand dst, 
+        Location loc) : 
+    base(std::move(base)), index(std::move(index)), scale(scale), disp(disp), dst(std::move(dst)), loc(loc) {}
 
-ASMTree::Program::Program(ASMTree::Function f) : f(std::move(f)) {}
+ASMTree::Idiv::Idiv(ASMTree::Operand operand, Location loc) : operand(std::move(operand)), loc(loc) {}
+
+ASMTree::WideMul::WideMul(ASMTree::Operand operand, Location loc) : operand(std::move(operand)), loc(loc) {}
+
+ASMTree::Mov::Mov(ASMTree::Operand src, ASMTree::Operand dst, Location loc) : 
+    src(std::move(src)), dst(std::move(dst)), loc(loc) {}
+
+ASMTree::DeallocateStack::DeallocateStack(int amount, Location loc) : amount(amount), loc(loc) {}
+
+ASMTree::Push::Push(ASMTree::Operand operand, Location loc) : operand(std::move(operand)), loc(loc) {}
+
+ASMTree::Call::Call(std::string name, bool external, Location loc) : 
+    name(std::move(name)), external(external), loc(loc) {}
+
+ASMTree::Cmp::Cmp(ASMTree::Operand src, ASMTree::Operand dst, Location loc) : 
+    src(std::move(src)), dst(std::move(dst)), loc(loc) {}
+
+ASMTree::Jmp::Jmp(std::string target, Location loc) : target(std::move(target)), loc(loc) {}
+
+ASMTree::JmpCC::JmpCC(ASMTree::CondCode cond, std::string target, Location loc) : 
+    cond(cond), target(std::move(target)), loc(loc) {}
+
+ASMTree::SetCC::SetCC(ASMTree::CondCode cond, ASMTree::Operand dst, Location loc) : 
+    cond(cond), dst(std::move(dst)), loc(loc) {}
+
+ASMTree::Label::Label(std::string name, Location loc) : name(std::move(name)), loc(loc) {}
+
+ASMTree::IncrementCounter::IncrementCounter(int counter, Location loc) : counter(counter), loc(loc) {}
+
+ASMTree::Function::Function(std::string identifier, Location loc) : identifier(std::move(identifier)), loc(loc) {}
+
+ASMTree::Program::Program(std::vector<ASMTree::Function> functions) : functions(std::move(functions)) {}
 
 template <typename T, typename V, typename F>
 void if_type(V&& variant, F&& func) {
@@ -39,150 +85,1195 @@ template<class... Ts> struct overloaded : Ts... {
 
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-void replace_operand(int& location, ASMTree::Operand& op, std::unordered_map<std::string, int>& table) {
-    if (!std::holds_alternative<ASMTree::Pseudo>(op)) {
-        return;
+ASMTree::Operand lower(TAC::Val&& v) {
+    return std::visit(
+        overloaded {
+            [](TAC::Constant& c) -> ASMTree::Operand { return ASMTree::Imm(c.val); },
+            [](TAC::Var& w) -> ASMTree::Operand { return ASMTree::Pseudo(std::move(w.identifier)); },
+            [](std::monostate) -> ASMTree::Operand { return ASMTree::Imm(0); }
+        }, v
+    );
+}
+
+// System V AMD64 integer argument registers, in order
+static const ASMTree::Reg::reg arg_regs[] = {
+    ASMTree::Reg::reg::DI,
+    ASMTree::Reg::reg::SI,
+    ASMTree::Reg::reg::DX,
+    ASMTree::Reg::reg::CX,
+    ASMTree::Reg::reg::R8,
+    ASMTree::Reg::reg::R9,
+};
+
+static constexpr size_t num_arg_regs = sizeof(arg_regs) / sizeof(arg_regs[0]);
+
+void lower_call(TAC::FunCall& c, bool external, std::vector<ASMTree::Instr>& instructions) {
+    size_t num_stack_args = c.args.size() > num_arg_regs ? c.args.size() - num_arg_regs : 0;
+
+    // %rsp has to be 16-byte aligned at the call, and the stack
+    // arguments are 8 bytes each
+    int padding = num_stack_args % 2 == 1 ? 8 : 0;
+    if (padding) {
+        instructions.emplace_back(ASMTree::AllocateStack{padding, c.loc});
     }
 
-    ASMTree::Pseudo& p = std::get<ASMTree::Pseudo>(op);
+    for (size_t idx = 0; idx < c.args.size() && idx < num_arg_regs; ++idx) {
+        instructions.emplace_back(ASMTree::Mov{lower(std::move(c.args[idx])), arg_regs[idx], c.loc});
+    }
 
-    if (!table.count(p.identifier)) {
-        location -= sizeof(int);
-        table[p.identifier] = location;
-        // TODO: When implementing support for more types,
-        // encode size information and change accordingly
+    for (size_t idx = c.args.size(); idx-- > num_arg_regs;) {
+        ASMTree::Operand arg = lower(std::move(c.args[idx]));
+        if (std::holds_alternative<ASMTree::Imm>(arg)) {
+            instructions.emplace_back(ASMTree::Push{std::move(arg), c.loc});
+        } else {
+            // A 4-byte variable is pushed through a register rather than
+            // reading 8 bytes of memory
+            instructions.emplace_back(ASMTree::Mov{std::move(arg), ASMTree::Reg::reg::AX, c.loc});
+            instructions.emplace_back(ASMTree::Push{ASMTree::Reg::reg::AX, c.loc});
+        }
     }
 
-    op = ASMTree::Stack(table[p.identifier]);
-}
+    instructions.emplace_back(ASMTree::Call{std::move(c.name), external, c.loc});
 
-int replace_pseudos(std::vector<ASMTree::Instr>& instructions) {
-    std::unordered_map<std::string, int> table;
-    int loc {};
-    for (auto& i : instructions) {
-        std::visit( overloaded {
-            [&table, &loc](ASMTree::Mov& m) -> void {
-                replace_operand(loc, m.src, table);
-                replace_operand(loc, m.dst, table);
-            },
-            [&table, &loc](ASMTree::Unary& u) -> void {
-                replace_operand(loc, u.operand, table);
-            },
-            [](const auto&) -> void {}
-        }, i);
+    int bytes = static_cast<int>(num_stack_args) * 8 + padding;
+    if (bytes) {
+        instructions.emplace_back(ASMTree::DeallocateStack{bytes, c.loc});
     }
 
-    return loc;
+    instructions.emplace_back(ASMTree::Mov{ASMTree::Reg::reg::AX, ASMTree::Pseudo(std::move(c.dst.identifier)), c.loc});
 }
 
-bool is_invalid_mov(ASMTree::Instr i) {
-    auto* instr_ptr = std::get_if<ASMTree::Mov>(&i);
-    if (!instr_ptr) {
-        return false;
+// Instruction selection for arithmetic. Each operator has one or more
+// candidate sequences that compute its result into a scratch register, and
+// the cheapest under a rough latency model is stored into the destination.
+// Working in %eax, %ecx and %edx keeps both operands of nearly every
+// instruction from being in memory, so few need fixing up afterwards.
+struct Candidate {
+    std::vector<ASMTree::Instr> instrs;
+    ASMTree::Reg::reg result;
+};
+
+int cost(const ASMTree::Instr& i) {
+    return std::visit(overloaded {
+        [](const ASMTree::Binary& b) -> int { return b.op == ASMTree::Binary::BinOp::MULT ? 3 : 1; },
+        [](const ASMTree::WideMul&) -> int { return 4; },
+        [](const ASMTree::Idiv&) -> int { return 26; },
+        [](const auto&) -> int { return 1; }
+    }, i);
+}
+
+int cost(const Candidate& c) {
+    int total {};
+    for (const auto& i : c.instrs) {
+        total += cost(i);
     }
+    return total;
+}
 
-    auto* dst_ptr = std::get_if<ASMTree::Stack>(&(instr_ptr->dst));
-    if (!dst_ptr) {
-        return false;
+// Ties go to the earlier candidate
+Candidate cheapest(std::vector<Candidate>&& candidates) {
+    size_t best {};
+    for (size_t idx = 1; idx < candidates.size(); ++idx) {
+        if (cost(candidates[idx]) < cost(candidates[best])) {
+            best = idx;
+        }
     }
+    return std::move(candidates[best]);
+}
 
-    auto* src_ptr = std::get_if<ASMTree::Stack>(&(instr_ptr->src));
-    if (!src_ptr) {
-        return false;
+int log2_exact(uint32_t m) {
+    if (m == 0 || (m & (m - 1)) != 0) {
+        return -1;
+    }
+    int k {};
+    while (m >>= 1) {
+        ++k;
     }
+    return k;
+}
 
-    return true;
+ASMTree::Instr binary(ASMTree::Binary::BinOp op, ASMTree::Operand src, ASMTree::Reg::reg dst, Location loc) {
+    return ASMTree::Binary(op, std::move(src), dst, loc);
 }
 
-auto get_mov_data(const ASMTree::Instr& instr) {
-    if (const auto* m = std::get_if<ASMTree::Mov>(&instr)) {
-        return std::make_pair(m->src, m->dst);
+// Multiplication by a constant as shifts and lea, which scales by 2, 4 or 8
+// and adds in one go, so 3, 5 and 9 each take a single instruction
+std::vector<Candidate> multiply(const ASMTree::Operand& x, int k, Location loc) {
+    using R = ASMTree::Reg::reg;
+    using Op = ASMTree::Binary::BinOp;
+
+    std::vector<Candidate> candidates;
+    candidates.push_back({ { ASMTree::Mov(x, R::AX, loc), binary(Op::MULT, ASMTree::Imm(k), R::AX, loc) }, R::AX });
+    if (k == 0) {
+        candidates.push_back({ { ASMTree::Mov(ASMTree::Imm(0), R::AX, loc) }, R::AX });
+        return candidates;
+    }
+
+    auto lea = [loc](int factor) -> ASMTree::Instr {
+        return ASMTree::Lea(R::AX, R::AX, factor - 1, 0, R::AX, loc);
+    };
+    auto shift = [loc](int k) -> ASMTree::Instr {
+        return binary(Op::SHL, ASMTree::Imm(k), R::AX, loc);
+    };
+
+    uint32_t m = k < 0 ? 0u - static_cast<uint32_t>(k) : static_cast<uint32_t>(k);
+    std::vector<std::vector<ASMTree::Instr>> bodies;
+    if (m == 1) {
+        bodies.push_back({});
+    } else if (int s = log2_exact(m); s > 0) {
+        bodies.push_back({ shift(s) });
+    }
+    for (int factor : { 3, 5, 9 }) {
+        if (m % factor != 0) {
+            continue;
+        }
+        uint32_t rest = m / factor;
+        if (rest == 1) {
+            bodies.push_back({ lea(factor) });
+        } else if (int s = log2_exact(rest); s > 0) {
+            bodies.push_back({ lea(factor), shift(s) });
+        } else if (rest == 3 || rest == 5 || rest == 9) {
+            bodies.push_back({ lea(factor), lea(static_cast<int>(rest)) });
+        }
+    }
+
+    for (auto& body : bodies) {
+        Candidate c = { { ASMTree::Mov(x, R::AX, loc) }, R::AX };
+        c.instrs.insert(c.instrs.end(), std::make_move_iterator(body.begin()), std::make_move_iterator(body.end()));
+        if (k < 0) {
+            c.instrs.emplace_back(ASMTree::Unary(ASMTree::Unary::UnOp::NEG, R::AX, loc));
+        }
+        candidates.push_back(std::move(c));
     }
 
-    throw std::runtime_error("Attempted to cast non-mov instruction to mov\n");
+    return candidates;
 }
 
-void split_invalid_movs(std::vector<ASMTree::Instr>& instructions) {
-    int num_invalid_movs { static_cast<int>(std::count_if(
-        instructions.begin(), 
-        instructions.end(),
-        is_invalid_mov) 
-    ) };
-    
-    std::vector<ASMTree::Instr> new_code;
-    new_code.reserve(instructions.size() + num_invalid_movs);
-
-    for (auto& instr : instructions) {
-        if (is_invalid_mov(instr)) {
-            auto [src, dst] = get_mov_data(instr);
-            new_code.emplace_back(ASMTree::Mov{src, ASMTree::Reg::reg::R10});
-            new_code.emplace_back(ASMTree::Mov(ASMTree::Reg::reg::R10, dst));
+// Multiplier and shift such that the high half of n * multiplier, shifted,
+// is n / d rounded towards negative infinity, from Hacker's Delight 10-1
+struct Magic {
+    int32_t multiplier;
+    int shift;
+};
+
+Magic magic(uint32_t d) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t anc = two31 - 1 - two31 % d;
+    int p = 31;
+    uint32_t q1 = two31 / anc;
+    uint32_t r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / d;
+    uint32_t r2 = two31 - q2 * d;
+    uint32_t delta;
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            ++q2;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    return Magic{ static_cast<int32_t>(q2 + 1), p - 32 };
+}
+
+// Division by a constant without idivl: powers of two are a shift after
+// biasing negative dividends so they round towards zero, and anything else
+// is a multiplication by its magic number
+std::vector<Candidate> divide(const ASMTree::Operand& n, int d, bool remainder, Location loc) {
+    using R = ASMTree::Reg::reg;
+    using Op = ASMTree::Binary::BinOp;
+
+    std::vector<Candidate> candidates;
+    candidates.push_back({ { ASMTree::Mov(n, R::AX, loc), ASMTree::Cdq{loc}, ASMTree::Mov(ASMTree::Imm(d), R::CX, loc), 
+        ASMTree::Idiv(R::CX, loc) }, remainder ? R::DX : R::AX });
+    // Dividing by 0 has to trap as the program would, and INT_MIN has no
+    // magnitude to work with
+    if (d == 0 || d == INT32_MIN) {
+        return candidates;
+    }
+
+    uint32_t m = d < 0 ? 0u - static_cast<uint32_t>(d) : static_cast<uint32_t>(d);
+    auto negate = [loc, d](Candidate& c) -> void {
+        if (d < 0) {
+            c.instrs.emplace_back(ASMTree::Unary(ASMTree::Unary::UnOp::NEG, c.result, loc));
+        }
+    };
+
+    if (m == 1) {
+        Candidate c = { { ASMTree::Mov(remainder ? ASMTree::Operand(ASMTree::Imm(0)) : n, R::AX, loc) }, R::AX };
+        if (!remainder) {
+            negate(c);
+        }
+        candidates.push_back(std::move(c));
+        return candidates;
+    }
+
+    if (int k = log2_exact(m); k > 0) {
+        Candidate c = { { ASMTree::Mov(n, R::AX, loc), ASMTree::Mov(R::AX, R::DX, loc) }, R::AX };
+        if (k > 1) {
+            c.instrs.push_back(binary(Op::SAR, ASMTree::Imm(31), R::DX, loc));
+        }
+        c.instrs.push_back(binary(Op::SHR, ASMTree::Imm(32 - k), R::DX, loc));
+        c.instrs.push_back(binary(Op::ADD, R::DX, R::AX, loc));
+        c.instrs.push_back(binary(Op::SAR, ASMTree::Imm(k), R::AX, loc));
+        if (remainder) {
+            c.instrs.push_back(binary(Op::SHL, ASMTree::Imm(k), R::AX, loc));
+            c.instrs.push_back(ASMTree::Mov(n, R::DX, loc));
+            c.instrs.push_back(binary(Op::SUB, R::AX, R::DX, loc));
+            c.result = R::DX;
         } else {
-            new_code.push_back(std::move(instr));
+            negate(c);
         }
+        candidates.push_back(std::move(c));
+        return candidates;
     }
 
-    instructions = std::move(new_code);
+    // The one-operand imull cannot take an immediate
+    Candidate c = { {}, R::DX };
+    ASMTree::Operand dividend = n;
+    if (std::holds_alternative<ASMTree::Imm>(n)) {
+        c.instrs.push_back(ASMTree::Mov(n, R::CX, loc));
+        dividend = R::CX;
+    }
+
+    Magic mg = magic(m);
+    c.instrs.push_back(ASMTree::Mov(ASMTree::Imm(mg.multiplier), R::AX, loc));
+    c.instrs.push_back(ASMTree::WideMul(dividend, loc));
+    // A multiplier past INT_MAX was taken as negative, which is made up
+    // for by adding the dividend back
+    if (mg.multiplier < 0) {
+        c.instrs.push_back(binary(Op::ADD, dividend, R::DX, loc));
+    }
+    if (mg.shift > 0) {
+        c.instrs.push_back(binary(Op::SAR, ASMTree::Imm(mg.shift), R::DX, loc));
+    }
+    // Rounding towards zero instead: one more for negative dividends
+    c.instrs.push_back(ASMTree::Mov(dividend, R::AX, loc));
+    c.instrs.push_back(binary(Op::SHR, ASMTree::Imm(31), R::AX, loc));
+    c.instrs.push_back(binary(Op::ADD, R::AX, R::DX, loc));
+
+    if (remainder) {
+        c.instrs.push_back(binary(Op::MULT, ASMTree::Imm(static_cast<int>(m)), R::DX, loc));
+        c.instrs.push_back(ASMTree::Mov(dividend, R::AX, loc));
+        c.instrs.push_back(binary(Op::SUB, R::DX, R::AX, loc));
+        c.result = R::AX;
+    } else {
+        negate(c);
+    }
+    candidates.push_back(std::move(c));
+
+    return candidates;
 }
 
-ASMTree::Operand lower(const TAC::Val& v) {
-    return std::visit(
-        overloaded {
-            [](const TAC::Constant& c) -> ASMTree::Operand { return ASMTree::Imm(c.val); },
-            [](const TAC::Var& w) -> ASMTree::Operand { return ASMTree::Pseudo(w.identifier); },
-            [](std::monostate) -> ASMTree::Operand { return ASMTree::Imm(0); }
-        }, v
-    );
+std::optional<ASMTree::CondCode> relation(TAC::Binary::BinOp op) {
+    switch (op) {
+        case TAC::Binary::BinOp::EQUAL: return ASMTree::CondCode::E;
+        case TAC::Binary::BinOp::NOT_EQUAL: return ASMTree::CondCode::NE;
+        case TAC::Binary::BinOp::LESS: return ASMTree::CondCode::L;
+        case TAC::Binary::BinOp::LESS_EQUAL: return ASMTree::CondCode::LE;
+        case TAC::Binary::BinOp::GREATER: return ASMTree::CondCode::G;
+        case TAC::Binary::BinOp::GREATER_EQUAL: return ASMTree::CondCode::GE;
+        default: return std::nullopt;
+    }
+}
+
+// The condition that holds with the operands of the comparison swapped
+ASMTree::CondCode mirror(ASMTree::CondCode cond) {
+    switch (cond) {
+        case ASMTree::CondCode::L: return ASMTree::CondCode::G;
+        case ASMTree::CondCode::LE: return ASMTree::CondCode::GE;
+        case ASMTree::CondCode::G: return ASMTree::CondCode::L;
+        case ASMTree::CondCode::GE: return ASMTree::CondCode::LE;
+        default: return cond;
+    }
+}
+
+ASMTree::CondCode negate(ASMTree::CondCode cond) {
+    switch (cond) {
+        case ASMTree::CondCode::E: return ASMTree::CondCode::NE;
+        case ASMTree::CondCode::NE: return ASMTree::CondCode::E;
+        case ASMTree::CondCode::L: return ASMTree::CondCode::GE;
+        case ASMTree::CondCode::LE: return ASMTree::CondCode::G;
+        case ASMTree::CondCode::G: return ASMTree::CondCode::LE;
+        case ASMTree::CondCode::GE: return ASMTree::CondCode::L;
+    }
+    return cond;
+}
+
+// Sets the flags for lhs cond rhs and returns the condition to test them
+// for. cmpl compares into a register or memory and takes at most one of
+// each operand from memory, so an immediate goes on the right, swapping the
+// operands if need be, and two variables meet in %eax.
+ASMTree::CondCode compare(const TAC::Val& lhs, const TAC::Val& rhs, ASMTree::CondCode cond, Location loc, 
+        std::vector<ASMTree::Instr>& instructions) {
+    ASMTree::Operand left = lower(TAC::Val(lhs));
+    ASMTree::Operand right = lower(TAC::Val(rhs));
+    if (std::holds_alternative<ASMTree::Imm>(left) && !std::holds_alternative<ASMTree::Imm>(right)) {
+        std::swap(left, right);
+        cond = mirror(cond);
+    } else if (!std::holds_alternative<ASMTree::Imm>(right) || std::holds_alternative<ASMTree::Imm>(left)) {
+        instructions.emplace_back(ASMTree::Mov(std::move(left), ASMTree::Reg::reg::AX, loc));
+        left = ASMTree::Reg::reg::AX;
+    }
+
+    instructions.emplace_back(ASMTree::Cmp(std::move(right), std::move(left), loc));
+    return cond;
+}
+
+// How one TAC instruction in a block is lowered, given the ones around it
+struct Selection {
+    // Folded into a later instruction, so nothing is emitted for it
+    bool folded = false;
+    // A comparison only the branch after it reads, which tests the flags
+    bool branch = false;
+    // Stores straight into this variable, for a copy that is then folded
+    std::optional<std::string> into;
+    // An addition whose operand is this multiplication by 2, 4 or 8
+    const TAC::Binary* scaled = nullptr;
+};
+
+// A multiplication x * s for s = 2, 4 or 8, as the index of an address
+const TAC::Binary* scaling(const TAC::Binary* b, const TAC::Val** index, int* scale) {
+    if (!b || b->op != TAC::Binary::BinOp::MULTIPLY) {
+        return nullptr;
+    }
+    for (int side = 0; side < 2; ++side) {
+        const TAC::Val& k = side == 0 ? b->src2 : b->src1;
+        const auto* c = std::get_if<TAC::Constant>(&k);
+        if (c && (c->val == 2 || c->val == 4 || c->val == 8)) {
+            *index = side == 0 ? &b->src1 : &b->src2;
+            *scale = c->val;
+            return b;
+        }
+    }
+    return nullptr;
+}
+
+// Looks for the combinations the selector can do better than one TAC
+// instruction at a time. Only temporaries read exactly once can be folded
+// away, since nothing else may see them.
+std::vector<Selection> select(const TAC::Block& block, const std::unordered_map<std::string, int>& uses) {
+    const auto& code = block.instructions;
+    std::vector<Selection> sel(code.size());
+
+    auto single_use = [&uses](const TAC::Val& v) -> const TAC::Var* {
+        const auto* w = std::get_if<TAC::Var>(&v);
+        auto it = w ? uses.find(w->identifier) : uses.end();
+        return it != uses.end() && it->second == 1 ? w : nullptr;
+    };
+
+    // A comparison right before the branch on its result sets the flags
+    // for the branch itself
+    if (code.size() >= 2) {
+        const auto* br = std::get_if<TAC::Branch>(&code.back());
+        const TAC::Var* cond = br ? single_use(br->cond) : nullptr;
+        const TAC::Var* dst = TAC::destination(code[code.size() - 2]);
+        const auto* b = std::get_if<TAC::Binary>(&code[code.size() - 2]);
+        const auto* u = std::get_if<TAC::Unary>(&code[code.size() - 2]);
+        bool compares = (b && relation(b->op)) || (u && u->op == TAC::Unary::UnOp::NOT);
+        if (cond && dst && compares && dst->identifier == cond->identifier) {
+            sel[code.size() - 2].folded = true;
+            sel[code.size() - 2].branch = true;
+        }
+    }
+
+    for (size_t idx = 0; idx < code.size(); ++idx) {
+        // x * s + y as a single lea, as long as x still holds the same
+        // value at the addition
+        const auto* add = std::get_if<TAC::Binary>(&code[idx]);
+        if (add && add->op == TAC::Binary::BinOp::ADD) {
+            for (const TAC::Val* operand : { &add->src1, &add->src2 }) {
+                const TAC::Var* t = single_use(*operand);
+                if (!t) {
+                    continue;
+                }
+
+                for (size_t def = idx; def-- > 0;) {
+                    const TAC::Var* dst = TAC::destination(code[def]);
+                    if (!dst || dst->identifier != t->identifier) {
+                        continue;
+                    }
+
+                    const TAC::Val* index = nullptr;
+                    int scale {};
+                    const TAC::Binary* mul = scaling(std::get_if<TAC::Binary>(&code[def]), &index, &scale);
+                    const auto* x = std::get_if<TAC::Var>(index);
+                    bool stable = true;
+                    for (size_t between = def + 1; mul && x && between < idx; ++between) {
+                        const TAC::Var* w = TAC::destination(code[between]);
+                        stable = stable && !(w && w->identifier == x->identifier);
+                    }
+                    if (mul && stable && !sel[def].folded) {
+                        sel[def].folded = true;
+                        sel[idx].scaled = mul;
+                    }
+                    break;
+                }
+
+                if (sel[idx].scaled) {
+                    break;
+                }
+            }
+        }
+
+        // A result that is only copied into a variable is stored there
+        // directly, which is what every assignment looks like
+        const TAC::Var* dst = TAC::destination(code[idx]);
+        bool computes = std::holds_alternative<TAC::Unary>(code[idx]) || std::holds_alternative<TAC::Binary>(code[idx]);
+        const auto* copy = idx + 1 < code.size() ? std::get_if<TAC::Copy>(&code[idx + 1]) : nullptr;
+        const TAC::Var* src = copy ? single_use(copy->src) : nullptr;
+        if (computes && !sel[idx].folded && src && src->identifier == dst->identifier) {
+            sel[idx].into = copy->dst.identifier;
+            sel[idx + 1].folded = true;
+        }
+    }
+
+    return sel;
 }
 
-void lower(const TAC::Instr& i, std::vector<ASMTree::Instr>& instructions) {
+void lower_binary(TAC::Binary& b, const TAC::Binary* scaled, ASMTree::Operand dst, 
+        std::vector<ASMTree::Instr>& instructions) {
+    using R = ASMTree::Reg::reg;
+    using Op = ASMTree::Binary::BinOp;
+    Location loc = b.loc;
+
+    if (std::optional<ASMTree::CondCode> cond = relation(b.op)) {
+        ASMTree::CondCode flags = compare(b.src1, b.src2, *cond, loc, instructions);
+        instructions.emplace_back(ASMTree::Mov(ASMTree::Imm(0), dst, loc));
+        instructions.emplace_back(ASMTree::SetCC(flags, std::move(dst), loc));
+        return;
+    }
+
+    ASMTree::Operand lhs = lower(std::move(b.src1));
+    ASMTree::Operand rhs = lower(std::move(b.src2));
+    const auto* lhs_imm = std::get_if<ASMTree::Imm>(&lhs);
+    const auto* rhs_imm = std::get_if<ASMTree::Imm>(&rhs);
+    std::vector<Candidate> candidates;
+
+    switch (b.op) {
+        case TAC::Binary::BinOp::ADD:
+            if (scaled) {
+                // The other operand of the addition is the multiplication's result
+                const TAC::Val* index = nullptr;
+                int scale {};
+                scaling(scaled, &index, &scale);
+                const auto* t = std::get_if<ASMTree::Pseudo>(&rhs);
+                bool rhs_scaled = t && t->identifier == scaled->dst.identifier;
+                ASMTree::Operand other = rhs_scaled ? lhs : rhs;
+
+                Candidate c = { { ASMTree::Mov(lower(TAC::Val(*index)), R::CX, loc) }, R::AX };
+                if (const auto* k = std::get_if<ASMTree::Imm>(&other)) {
+                    c.instrs.push_back(ASMTree::Lea(std::monostate{}, R::CX, scale, k->val, R::AX, loc));
+                } else {
+                    c.instrs.push_back(ASMTree::Mov(std::move(other), R::AX, loc));
+                    c.instrs.push_back(ASMTree::Lea(R::AX, R::CX, scale, 0, R::AX, loc));
+                }
+                candidates.push_back(std::move(c));
+                break;
+            }
+            if (lhs_imm && !rhs_imm) {
+                std::swap(lhs, rhs);
+            }
+            candidates.push_back({ { ASMTree::Mov(std::move(lhs), R::AX, loc), binary(Op::ADD, std::move(rhs), R::AX, loc) }, R::AX });
+            break;
+        case TAC::Binary::BinOp::SUBTRACT:
+            candidates.push_back({ { ASMTree::Mov(std::move(lhs), R::AX, loc), binary(Op::SUB, std::move(rhs), R::AX, loc) }, R::AX });
+            break;
+        case TAC::Binary::BinOp::MULTIPLY:
+            if (rhs_imm) {
+                candidates = multiply(lhs, rhs_imm->val, loc);
+            } else if (lhs_imm) {
+                candidates = multiply(rhs, lhs_imm->val, loc);
+            } else {
+                candidates.push_back({ { ASMTree::Mov(std::move(lhs), R::AX, loc), binary(Op::MULT, std::move(rhs), R::AX, loc) }, R::AX });
+            }
+            break;
+        case TAC::Binary::BinOp::DIVIDE:
+        case TAC::Binary::BinOp::REMAINDER: {
+            bool remainder = b.op == TAC::Binary::BinOp::REMAINDER;
+            if (rhs_imm) {
+                candidates = divide(lhs, rhs_imm->val, remainder, loc);
+            } else {
+                candidates.push_back({ { ASMTree::Mov(std::move(lhs), R::AX, loc), ASMTree::Cdq{loc}, 
+                    ASMTree::Idiv(std::move(rhs), loc) }, remainder ? R::DX : R::AX });
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    Candidate c = cheapest(std::move(candidates));
+    instructions.insert(instructions.end(), std::make_move_iterator(c.instrs.begin()), std::make_move_iterator(c.instrs.end()));
+    instructions.emplace_back(ASMTree::Mov(c.result, std::move(dst), loc));
+}
+
+void lower(TAC::Instr& i, const Selection& sel, std::vector<ASMTree::Instr>& instructions, 
+        const std::unordered_set<std::string>& defined) {
+    auto destination = [&sel](TAC::Var& dst) -> ASMTree::Operand {
+        return ASMTree::Pseudo(sel.into ? *sel.into : std::move(dst.identifier));
+    };
+
     std::visit(
         overloaded {
-            [&instructions](TAC::Return r) -> void {
-                instructions.emplace_back(ASMTree::Mov{lower(r.val), ASMTree::Reg::reg::AX});
-                instructions.emplace_back(ASMTree::Ret{});
+            [&instructions](TAC::Return& r) -> void {
+                instructions.emplace_back(ASMTree::Mov{lower(std::move(r.val)), ASMTree::Reg::reg::AX, r.loc});
+                instructions.emplace_back(ASMTree::Ret{r.loc});
             },
-            [&instructions](TAC::Unary u) -> void {
-                instructions.emplace_back(ASMTree::Mov{lower(u.src), lower(u.dst)});
+            [&instructions, &destination](TAC::Unary& u) -> void {
+                ASMTree::Operand dst = destination(u.dst);
 
-                ASMTree::Unary::UnOp unop;
-                switch (u.op) {
-                    case TAC::Unary::UnOp::COMPLEMENT:
-                        unop = ASMTree::Unary::UnOp::NOT;
-                        break;
-                    case TAC::Unary::UnOp::NEGATE:
-                        unop = ASMTree::Unary::UnOp::NEG;
-                        break;
+                if (u.op == TAC::Unary::UnOp::NOT) {
+                    compare(u.src, TAC::Constant(0), ASMTree::CondCode::E, u.loc, instructions);
+                    instructions.emplace_back(ASMTree::Mov(ASMTree::Imm(0), dst, u.loc));
+                    instructions.emplace_back(ASMTree::SetCC(ASMTree::CondCode::E, std::move(dst), u.loc));
+                    return;
                 }
 
-                instructions.emplace_back(ASMTree::Unary{unop, lower(u.dst)});
+                instructions.emplace_back(ASMTree::Mov{lower(std::move(u.src)), dst, u.loc});
+
+                ASMTree::Unary::UnOp unop = u.op == TAC::Unary::UnOp::COMPLEMENT 
+                    ? ASMTree::Unary::UnOp::NOT 
+                    : ASMTree::Unary::UnOp::NEG;
+
+                instructions.emplace_back(ASMTree::Unary{unop, std::move(dst), u.loc});
+            },
+            [&instructions, &destination, &sel](TAC::Binary& b) -> void {
+                lower_binary(b, sel.scaled, destination(b.dst), instructions);
+            },
+            [&instructions](TAC::Copy& c) -> void {
+                instructions.emplace_back(ASMTree::Mov{lower(std::move(c.src)), ASMTree::Pseudo(std::move(c.dst.identifier)), c.loc});
+            },
+            [&instructions, &defined](TAC::FunCall& c) -> void {
+                lower_call(c, !defined.count(c.name), instructions);
             },
+            // Jumps depend on the block layout and are lowered with it, and
+            // phis become copies on the edges into their block
+            [](const TAC::Jump&) -> void {},
+            [](const TAC::Branch&) -> void {},
+            [](const TAC::Phi&) -> void {},
             [](std::monostate) -> void {} 
         }, i
     );
 }
 
-ASMTree::Function lower(const TAC::Function& f) {
-    ASMTree::Function asm_f = ASMTree::Function(f.identifier);
-    
-    asm_f.instructions.emplace_back(ASMTree::AllocateStack{0});
+std::string block_label(const std::string& function, size_t block) {
+    return ".L" + function + "." + std::to_string(block);
+}
+
+std::string block_counter(const TAC::Origin& origin) {
+    return Profile::block_counter(origin.function, origin.shape, origin.block);
+}
 
-    for (const auto& i : f.instructions) {
-        lower(i, asm_f.instructions);
+// Orders the blocks so that each one is followed by its likeliest successor,
+// which it then reaches without a jump. With profile counts for the blocks
+// they came from, that is the successor that ran most often; otherwise,
+// and between successors that ran equally often, branches are expected to
+// stay in the innermost loop they are in, and otherwise to go to their
+// true side.
+std::vector<size_t> layout(const TAC::Function& f, const std::optional<Profile::Data>& profile) {
+    CFG::Graph g = CFG::Graph(f);
+    CFG::Dominators dom = CFG::Dominators(g);
+    CFG::Loops loops = CFG::Loops(g, dom);
+
+    std::vector<std::optional<uint64_t>> counts(f.blocks.size());
+    for (size_t b = 0; profile && b < f.blocks.size(); ++b) {
+        const auto& origin = f.blocks[b].origin;
+        auto it = origin ? profile->counts.find(block_counter(*origin)) : profile->counts.end();
+        if (it != profile->counts.end()) {
+            counts[b] = it->second;
+        }
+    }
+
+    std::vector<bool> placed(f.blocks.size());
+    std::vector<size_t> order;
+    order.reserve(f.blocks.size());
+
+    auto likelier = [&counts, &loops](size_t s, size_t best) -> bool {
+        if (counts[s] && counts[best] && *counts[s] != *counts[best]) {
+            return *counts[s] > *counts[best];
+        }
+        return loops.depth[s] > loops.depth[best];
+    };
+
+    auto likely_successor = [&g, &placed, &likelier](size_t b) -> size_t {
+        size_t best = CFG::NONE;
+        for (size_t s : g.succs[b]) {
+            if (!placed[s] && (best == CFG::NONE || likelier(s, best))) {
+                best = s;
+            }
+        }
+        return best;
+    };
+
+    // Chains start at the entry, then at whatever comes first in reverse
+    // postorder, and unreachable blocks go last in their original order
+    std::vector<size_t> starts = CFG::reverse_postorder(g);
+    for (size_t b = 0; b < f.blocks.size(); ++b) {
+        starts.push_back(b);
+    }
+
+    for (size_t start : starts) {
+        for (size_t b = start; b != CFG::NONE && !placed[b]; b = likely_successor(b)) {
+            placed[b] = true;
+            order.push_back(b);
+        }
+    }
+
+    return order;
+}
+
+// The moves that give to's phis their values when control comes from
+// from. The phis all read before any of them assigns, so each move waits
+// until nothing left to do still reads what it overwrites, and a cycle of
+// moves is broken by saving one of the values to a temporary first.
+std::vector<ASMTree::Instr> phi_copies(const TAC::Function& f, size_t from, size_t to, int& temps) {
+    struct Move {
+        ASMTree::Operand src;
+        std::string dst;
+        Location loc;
+    };
+
+    std::vector<Move> pending;
+    for (const auto& i : f.blocks[to].instructions) {
+        const auto* phi = std::get_if<TAC::Phi>(&i);
+        if (!phi) {
+            break;
+        }
+        for (const auto& [pred, val] : phi->incoming) {
+            const auto* w = std::get_if<TAC::Var>(&val);
+            if (pred == from && !(w && w->identifier == phi->dst.identifier)) {
+                pending.push_back(Move{ lower(TAC::Val(val)), phi->dst.identifier, phi->loc });
+                break;
+            }
+        }
+    }
+
+    auto reads = [&pending](const std::string& var) -> bool {
+        return std::any_of(pending.begin(), pending.end(), [&var](const Move& m) -> bool {
+            const auto* p = std::get_if<ASMTree::Pseudo>(&m.src);
+            return p && p->identifier == var;
+        });
+    };
+
+    std::vector<ASMTree::Instr> instructions;
+    while (!pending.empty()) {
+        auto ready = std::find_if(pending.begin(), pending.end(), [&reads](const Move& m) -> bool {
+            return !reads(m.dst);
+        });
+
+        if (ready != pending.end()) {
+            instructions.emplace_back(ASMTree::Mov(std::move(ready->src), ASMTree::Pseudo(ready->dst), ready->loc));
+            pending.erase(ready);
+            continue;
+        }
+
+        std::string temp = "phi.swap." + std::to_string(temps++);
+        const Move& first = pending.front();
+        instructions.emplace_back(ASMTree::Mov(ASMTree::Pseudo(first.dst), ASMTree::Pseudo(temp), first.loc));
+        std::string saved = first.dst;
+        for (auto& m : pending) {
+            const auto* p = std::get_if<ASMTree::Pseudo>(&m.src);
+            if (p && p->identifier == saved) {
+                m.src = ASMTree::Pseudo(temp);
+            }
+        }
+    }
+
+    return instructions;
+}
+
+// next is the block laid out right after this one, which needs no jump.
+// flags is set when a folded comparison has already set the flags for a
+// branch, and is the condition under which it goes to its true side.
+// copies gives the moves into the phis of each successor; a branch runs
+// those of the side it falls through to in line, and those of the side it
+// jumps to in a stub added to stubs.
+void lower_terminator(TAC::Instr& i, const std::string& function, size_t block, size_t next, 
+        std::optional<ASMTree::CondCode> flags, const std::function<std::vector<ASMTree::Instr>(size_t)>& copies,
+        std::vector<ASMTree::Instr>& instructions, std::vector<ASMTree::Instr>& stubs) {
+    auto append = [](std::vector<ASMTree::Instr>& code, std::vector<ASMTree::Instr>&& moves) -> void {
+        code.insert(code.end(), std::make_move_iterator(moves.begin()), std::make_move_iterator(moves.end()));
+    };
+
+    if (const auto* j = std::get_if<TAC::Jump>(&i)) {
+        append(instructions, copies(j->target));
+        if (j->target != next) {
+            instructions.emplace_back(ASMTree::Jmp{block_label(function, j->target), j->loc});
+        }
+        return;
+    }
+
+    auto& br = std::get<TAC::Branch>(i);
+    ASMTree::CondCode cond = ASMTree::CondCode::NE;
+    if (flags) {
+        cond = *flags;
+    } else {
+        cond = compare(br.cond, TAC::Constant(0), cond, br.loc, instructions);
     }
 
-    int stack_size { - replace_pseudos(asm_f.instructions) };
-    split_invalid_movs(asm_f.instructions);
+    auto jump_target = [&](size_t target) -> std::string {
+        std::vector<ASMTree::Instr> moves = copies(target);
+        if (moves.empty()) {
+            return block_label(function, target);
+        }
+
+        std::string stub = block_label(function, block) + "." + std::to_string(target);
+        stubs.emplace_back(ASMTree::Label{stub, Location{}});
+        append(stubs, std::move(moves));
+        stubs.emplace_back(ASMTree::Jmp{block_label(function, target), br.loc});
+        return stub;
+    };
+
+    if (br.if_true == next) {
+        instructions.emplace_back(ASMTree::JmpCC{negate(cond), jump_target(br.if_false), br.loc});
+        append(instructions, copies(br.if_true));
+        return;
+    }
+
+    instructions.emplace_back(ASMTree::JmpCC{cond, jump_target(br.if_true), br.loc});
+    append(instructions, copies(br.if_false));
+    if (br.if_false != next) {
+        instructions.emplace_back(ASMTree::Jmp{block_label(function, br.if_false), br.loc});
+    }
+}
+
+// Before phis become copies, a phi and the variables it takes share one
+// name wherever their values are never live at the same time, leaving
+// those copies moving a value onto itself. Two values are live at once
+// only if one is live where the other is assigned, and in SSA form the one
+// assigned first dominates the other's assignment, so that is the one
+// place each pair needs checking (Budimlić et al.).
+void coalesce_phis(TAC::Function& f) {
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<std::string> names;
+    auto id = [&ids, &names](const std::string& var) -> size_t {
+        auto [it, inserted] = ids.try_emplace(var, names.size());
+        if (inserted) {
+            names.push_back(var);
+        }
+        return it->second;
+    };
+
+    for (const auto& block : f.blocks) {
+        for (const auto& i : block.instructions) {
+            const auto* phi = std::get_if<TAC::Phi>(&i);
+            if (!phi) {
+                break;
+            }
+            id(phi->dst.identifier);
+            for (const auto& in : phi->incoming) {
+                if (const auto* w = std::get_if<TAC::Var>(&in.second)) {
+                    id(w->identifier);
+                }
+            }
+        }
+    }
+    if (names.empty()) {
+        return;
+    }
+
+    CFG::Graph g = CFG::Graph(f);
+    CFG::Dominators dom = CFG::Dominators(g);
+    size_t num_blocks = f.blocks.size();
+
+    // Where each is assigned: phis at 0 and the rest of a block's
+    // instructions from 1 on. Parameters, and variables nothing assigns,
+    // hold their value from the start of the entry.
+    struct Def {
+        size_t block;
+        size_t pos;
+    };
+    std::vector<Def> defs(names.size(), Def{0, 0});
+
+    // Where each is read: the blocks reading it, and for a phi the block
+    // the value comes from, where it is live out rather than in
+    std::vector<std::vector<size_t>> reads(names.size());
+    std::vector<std::vector<size_t>> phi_reads(names.size());
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const auto& code = f.blocks[b].instructions;
+        for (size_t idx = 0; idx < code.size(); ++idx) {
+            const auto* phi = std::get_if<TAC::Phi>(&code[idx]);
+            if (const TAC::Var* dst = TAC::destination(code[idx])) {
+                auto it = ids.find(dst->identifier);
+                if (it != ids.end()) {
+                    defs[it->second] = Def{b, phi ? 0 : idx + 1};
+                }
+            }
+            if (phi) {
+                for (const auto& [pred, val] : phi->incoming) {
+                    const auto* w = std::get_if<TAC::Var>(&val);
+                    auto it = w ? ids.find(w->identifier) : ids.end();
+                    if (it != ids.end() && pred < num_blocks) {
+                        phi_reads[it->second].push_back(pred);
+                    }
+                }
+                continue;
+            }
+            for (const auto* src : TAC::sources(code[idx])) {
+                const auto* w = std::get_if<TAC::Var>(src);
+                auto it = w ? ids.find(w->identifier) : ids.end();
+                if (it != ids.end()) {
+                    reads[it->second].push_back(b);
+                }
+            }
+        }
+    }
+
+    // Liveness of just these variables, one at a time: a value is live into
+    // a block reading it other than where it is assigned, and from there
+    // back up through the predecessors until the assignment
+    std::unordered_set<uint64_t> live_out;
+    auto out_key = [num_blocks](size_t v, size_t b) -> uint64_t {
+        return uint64_t(v) * num_blocks + b;
+    };
+    std::vector<size_t> live_in(num_blocks, CFG::NONE);
+    std::vector<size_t> work;
+    for (size_t v = 0; v < names.size(); ++v) {
+        size_t home = defs[v].block;
+        auto enter = [&live_in, &work, home, v](size_t b) -> void {
+            if (b != home && live_in[b] != v) {
+                live_in[b] = v;
+                work.push_back(b);
+            }
+        };
+        for (size_t b : reads[v]) {
+            enter(b);
+        }
+        for (size_t b : phi_reads[v]) {
+            live_out.insert(out_key(v, b));
+            enter(b);
+        }
+        while (!work.empty()) {
+            size_t b = work.back();
+            work.pop_back();
+            for (size_t p : g.preds[b]) {
+                live_out.insert(out_key(v, p));
+                enter(p);
+            }
+        }
+    }
+
+    // Whether v is still needed after position pos of block b
+    auto live_after = [&f, &names, &live_out, &out_key](size_t v, size_t b, size_t pos) -> bool {
+        if (live_out.count(out_key(v, b))) {
+            return true;
+        }
+        const auto& code = f.blocks[b].instructions;
+        for (size_t idx = pos; idx < code.size(); ++idx) {
+            if (std::holds_alternative<TAC::Phi>(code[idx])) {
+                continue;
+            }
+            for (const auto* src : TAC::sources(code[idx])) {
+                const auto* w = std::get_if<TAC::Var>(src);
+                if (w && w->identifier == names[v]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    // Definitions in the order of a walk of the dominator tree, which puts
+    // each one after every definition dominating it
+    std::vector<size_t> preorder(num_blocks, CFG::NONE);
+    std::vector<size_t> walk;
+    if (dom.idom[0] != CFG::NONE) {
+        walk.push_back(0);
+    }
+    for (size_t n = 0; !walk.empty(); ++n) {
+        size_t b = walk.back();
+        walk.pop_back();
+        preorder[b] = n;
+        walk.insert(walk.end(), dom.children[b].rbegin(), dom.children[b].rend());
+    }
+    auto before = [&defs, &preorder](size_t x, size_t y) -> bool {
+        const Def& dx = defs[x];
+        const Def& dy = defs[y];
+        return std::tie(preorder[dx.block], dx.block, dx.pos) < std::tie(preorder[dy.block], dy.block, dy.pos);
+    };
+    auto covers = [&defs, &dom](size_t x, size_t y) -> bool {
+        const Def& dx = defs[x];
+        const Def& dy = defs[y];
+        return dx.block == dy.block ? dx.pos <= dy.pos : dom.dominates(dx.block, dy.block);
+    };
+
+    // Whether x, assigned no later than y, still holds a value where y is
+    // assigned. Two assigned at the same place clash if either is needed
+    // after it, which is stricter than it has to be but keeps a clash with
+    // anything y covers showing up as one with y.
+    auto interfere = [&defs, &live_after](size_t x, size_t y) -> bool {
+        const Def& dx = defs[x];
+        const Def& dy = defs[y];
+        bool same = dx.block == dy.block && dx.pos == dy.pos;
+        return live_after(x, dy.block, dy.pos) || (same && live_after(y, dy.block, dy.pos));
+    };
+
+    // Classes of variables that take one name, each kept in the order
+    // above. Two classes with no clash inside either can only clash between
+    // a variable and the nearest one of the other covering it, so a merge
+    // checks those pairs alone (Budimlic's dominance forest).
+    std::vector<size_t> parent(names.size());
+    std::vector<std::vector<size_t>> members(names.size());
+    for (size_t v = 0; v < names.size(); ++v) {
+        parent[v] = v;
+        members[v] = { v };
+    }
+    auto find = [&parent](size_t v) -> size_t {
+        while (parent[v] != v) {
+            v = parent[v] = parent[parent[v]];
+        }
+        return v;
+    };
+
+    auto merge = [&members, &find, &before, &covers, &interfere](size_t a, size_t c) -> bool {
+        std::vector<size_t> merged;
+        merged.reserve(members[a].size() + members[c].size());
+        std::merge(members[a].begin(), members[a].end(), members[c].begin(), members[c].end(),
+            std::back_inserter(merged), before);
+
+        std::vector<size_t> stack;
+        for (size_t v : merged) {
+            while (!stack.empty() && !covers(stack.back(), v)) {
+                stack.pop_back();
+            }
+            if (!stack.empty() && find(stack.back()) != find(v) && interfere(stack.back(), v)) {
+                return false;
+            }
+            stack.push_back(v);
+        }
+
+        members[a] = std::move(merged);
+        members[c].clear();
+        return true;
+    };
+
+    for (const auto& block : f.blocks) {
+        for (const auto& i : block.instructions) {
+            const auto* phi = std::get_if<TAC::Phi>(&i);
+            if (!phi) {
+                break;
+            }
+            for (const auto& in : phi->incoming) {
+                const auto* w = std::get_if<TAC::Var>(&in.second);
+                if (!w) {
+                    continue;
+                }
+                size_t a = find(ids.at(phi->dst.identifier));
+                size_t c = find(ids.at(w->identifier));
+                if (a != c && merge(a, c)) {
+                    parent[c] = a;
+                }
+            }
+        }
+    }
+
+    auto rename = [&ids, &names, &find](std::string& var) -> void {
+        auto it = ids.find(var);
+        if (it != ids.end()) {
+            var = names[find(it->second)];
+        }
+    };
+
+    for (auto& param : f.params) {
+        rename(param);
+    }
+    for (auto& block : f.blocks) {
+        for (auto& i : block.instructions) {
+            for (auto* src : TAC::sources(i)) {
+                if (auto* w = std::get_if<TAC::Var>(src)) {
+                    rename(w->identifier);
+                }
+            }
+            if (TAC::Var* dst = TAC::destination(i)) {
+                rename(dst->identifier);
+            }
+        }
+    }
+}
+
+// The profile counters a function bumps: one on entry, and one for each
+// block that still has an origin, -1 where there is none
+struct Counters {
+    int entry = -1;
+    std::vector<int> blocks;
+};
+
+ASMTree::Function lower(TAC::Function&& f, const Passes::Options& opts, 
+        const std::unordered_set<std::string>& defined, const Counters& counters) {
+    coalesce_phis(f);
+
+    ASMTree::Function asm_f = ASMTree::Function(std::move(f.identifier), f.loc);
     
-    auto& as = std::get<ASMTree::AllocateStack>(asm_f.instructions[0]);
-    as.amount = stack_size;
+    asm_f.instructions.emplace_back(ASMTree::AllocateStack{0, f.loc});
+
+    if (counters.entry >= 0) {
+        asm_f.instructions.emplace_back(ASMTree::IncrementCounter{counters.entry, f.loc});
+    }
+
+    for (size_t idx = 0; idx < f.params.size(); ++idx) {
+        ASMTree::Operand src = idx < num_arg_regs
+            ? ASMTree::Operand(ASMTree::Reg(arg_regs[idx]))
+            // Past the saved %rbp and the return address
+            : ASMTree::Operand(ASMTree::Stack(16 + 8 * static_cast<int>(idx - num_arg_regs)));
+        asm_f.instructions.emplace_back(ASMTree::Mov{std::move(src), ASMTree::Pseudo(std::move(f.params[idx])), f.loc});
+    }
+
+    std::vector<size_t> order;
+    if (opts.enabled("layout-blocks", 1)) {
+        order = layout(f, opts.profile);
+    } else {
+        for (size_t b = 0; b < f.blocks.size(); ++b) {
+            order.push_back(b);
+        }
+    }
+
+    std::unordered_map<std::string, int> uses;
+    for (const auto& block : f.blocks) {
+        for (const auto& i : block.instructions) {
+            for (const auto* src : TAC::sources(i)) {
+                if (const auto* w = std::get_if<TAC::Var>(src)) {
+                    ++uses[w->identifier];
+                }
+            }
+        }
+    }
+
+    std::vector<bool> is_target(f.blocks.size());
+    for (const auto& block : f.blocks) {
+        for (size_t s : TAC::successors(block)) {
+            is_target[s] = true;
+        }
+    }
+
+    // Edges out of a branch into a block with phis may need a stub for
+    // their copies, and the stubs go after all the blocks
+    std::vector<ASMTree::Instr> stubs;
+    int temps {};
+
+    for (size_t pos = 0; pos < order.size(); ++pos) {
+        size_t b = order[pos];
+        size_t next = pos + 1 < order.size() ? order[pos + 1] : CFG::NONE;
+        auto copies = [&f, &temps, b](size_t target) -> std::vector<ASMTree::Instr> {
+            return phi_copies(f, b, target, temps);
+        };
+
+        if (is_target[b]) {
+            asm_f.instructions.emplace_back(ASMTree::Label{block_label(asm_f.identifier, b), Location{}});
+        }
+        // First in the block, as the increment changes the flags
+        if (b < counters.blocks.size() && counters.blocks[b] >= 0) {
+            asm_f.instructions.emplace_back(ASMTree::IncrementCounter{counters.blocks[b], Location{}});
+        }
+
+        auto& code = f.blocks[b].instructions;
+        std::vector<Selection> sel = select(f.blocks[b], uses);
+        for (size_t idx = 0; idx < code.size(); ++idx) {
+            auto& i = code[idx];
+            if (!std::holds_alternative<TAC::Jump>(i) && !std::holds_alternative<TAC::Branch>(i)) {
+                if (!sel[idx].folded) {
+                    lower(i, sel[idx], asm_f.instructions, defined);
+                }
+                continue;
+            }
+
+            std::optional<ASMTree::CondCode> flags;
+            if (idx > 0 && sel[idx - 1].branch) {
+                if (const auto* cmp = std::get_if<TAC::Binary>(&code[idx - 1])) {
+                    flags = compare(cmp->src1, cmp->src2, *relation(cmp->op), cmp->loc, asm_f.instructions);
+                } else {
+                    const auto& u = std::get<TAC::Unary>(code[idx - 1]);
+                    flags = compare(u.src, TAC::Constant(0), ASMTree::CondCode::E, u.loc, asm_f.instructions);
+                }
+            }
+            lower_terminator(i, asm_f.identifier, b, next, flags, copies, asm_f.instructions, stubs);
+        }
+    }
+    asm_f.instructions.insert(asm_f.instructions.end(), std::make_move_iterator(stubs.begin()), 
+        std::make_move_iterator(stubs.end()));
+
+    Passes::optimize(asm_f, opts);
     
     return asm_f;
 }
 
-ASMTree::Program ASMTree::lower(const TAC::Program& p) {
-    // Due to naming conflict between ASMTree::lower and 
-    // lower overloads not in the namespace, explicit 
-    // nameless namespace before call to lower is required
-    return ASMTree::Program(::lower(p.f));
+ASMTree::Program ASMTree::lower(TAC::Program&& p, const Passes::Options& opts) {
+    std::unordered_set<std::string> defined;
+    for (const auto& f : p.functions) {
+        defined.insert(f.identifier);
+    }
+
+    return lower(std::move(p), opts, defined);
+}
+
+ASMTree::Program ASMTree::lower(TAC::Program&& p, const Passes::Options& opts, 
+        const std::unordered_set<std::string>& defined) {
+    // Take ownership so the TAC is freed as soon as lowering is done
+    TAC::Program tac = std::move(p);
+    size_t num_functions = tac.functions.size();
+    bool profiling = !opts.profile_generate.empty();
+
+    // Counters are named after the blocks they count as first emitted, so
+    // that a build which inlines finds the counts of the blocks it copied.
+    // An instrumented build inlines nothing, so each block is counted once
+    std::vector<std::string> counters;
+    std::vector<Counters> bumps(num_functions);
+    for (size_t idx = 0; idx < num_functions && profiling; ++idx) {
+        TAC::Function& f = tac.functions[idx];
+        CFG::mark_origins(f);
+        bumps[idx].entry = static_cast<int>(counters.size());
+        counters.push_back(Profile::function_counter(f.identifier));
+        bumps[idx].blocks.resize(f.blocks.size(), -1);
+        for (size_t b = 0; b < f.blocks.size(); ++b) {
+            if (const auto& origin = f.blocks[b].origin) {
+                bumps[idx].blocks[b] = static_cast<int>(counters.size());
+                counters.push_back(block_counter(*origin));
+            }
+        }
+    }
+
+    // Functions are independent from here on, so they are lowered in
+    // parallel, each worker taking the next function not yet claimed
+    std::vector<std::optional<ASMTree::Function>> lowered(num_functions);
+    std::atomic<size_t> next {0};
+
+    auto worker = [&]() -> void {
+        for (size_t idx = next++; idx < num_functions; idx = next++) {
+            // Due to naming conflict between ASMTree::lower and 
+            // lower overloads not in the namespace, explicit 
+            // nameless namespace before call to lower is required
+            lowered[idx] = ::lower(std::move(tac.functions[idx]), opts, defined, bumps[idx]);
+        }
+    };
+
+    size_t num_threads = std::min<size_t>(num_functions, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::vector<ASMTree::Function> functions;
+    functions.reserve(num_functions);
+    for (auto& f : lowered) {
+        functions.push_back(std::move(*f));
+    }
+
+    ASMTree::Program asm_p = ASMTree::Program(std::move(functions));
+    asm_p.source = std::move(tac.source);
+    asm_p.counters = std::move(counters);
+    asm_p.profile_path = opts.profile_generate;
+    return asm_p;
 }
\ No newline at end of file
@@ -5,8 +5,13 @@
 #include <variant>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include "tac.hpp"
 
+namespace Passes {
+    struct Options;
+}
+
 namespace ASMTree {
     struct Imm {
         int val;
@@ -17,7 +22,14 @@ namespace ASMTree {
     struct Reg {
         enum class reg {
             AX,
+            CX,
+            DX,
+            DI,
+            SI,
+            R8,
+            R9,
             R10,
+            R11,
         };
 
         Reg::reg r;
@@ -39,12 +51,25 @@ namespace ASMTree {
 
     using Operand = std::variant<std::monostate, Imm, Reg, Pseudo, Stack>;
 
-    struct Ret {};
+    // Signed comparisons, as set by Cmp
+    enum class CondCode {
+        E,
+        NE,
+        L,
+        LE,
+        G,
+        GE,
+    };
+
+    struct Ret {
+        Location loc;
+    };
 
     struct AllocateStack {
         int amount;
+        Location loc;
 
-        AllocateStack(int amount);
+        AllocateStack(int amount, Location loc);
     };
 
     struct Unary {
@@ -55,32 +80,172 @@ namespace ASMTree {
 
         Unary::UnOp op;
         Operand operand;
+        Location loc;
+
+        Unary(Unary::UnOp op, Operand operand, Location loc);
+    };
+
+    // dst = dst op src; shift counts are always immediates
+    struct Binary {
+        enum class BinOp {
+            ADD,
+            SUB,
+            MULT,
+            SHL,
+            SAR,
+            SHR,
+        };
+
+        Binary::BinOp op;
+        Operand src;
+        Operand dst;
+        Location loc;
+
+        Binary(Binary::BinOp op, Operand src, Operand dst, Location loc);
+    };
+
+    // dst = base + index * scale + disp, computed by the address unit
+    // without touching the flags. base and index are registers, and either
+    // may be left empty.
+    struct Lea {
+        Operand base;
+        Operand index;
+        int scale;
+        int disp;
+        Operand dst;
+        Location loc;
+
+        Lea(Operand base, Operand index, int scale, int disp, Operand dst, Location loc);
+    };
+
+    // Sign-extends %eax into %edx
+    struct Cdq {
+        Location loc;
+    };
+
+    // Divides %edx:%eax by operand, leaving the quotient in %eax and the
+    // remainder in %edx
+    struct Idiv {
+        Operand operand;
+        Location loc;
 
-        Unary(Unary::UnOp op, Operand operand);
+        Idiv(Operand operand, Location loc);
+    };
+
+    // Multiplies %eax by operand, leaving the full product in %edx:%eax
+    struct WideMul {
+        Operand operand;
+        Location loc;
+
+        WideMul(Operand operand, Location loc);
     };
 
     struct Mov {
         Operand src;
         Operand dst;
+        Location loc;
 
-        Mov(Operand src, Operand dst);
+        Mov(Operand src, Operand dst, Location loc);
     };
 
-    using Instr = std::variant<std::monostate, Ret, Mov, Unary, AllocateStack>;
+    struct DeallocateStack {
+        int amount;
+        Location loc;
+
+        DeallocateStack(int amount, Location loc);
+    };
+
+    // Pushes the 8-byte form of operand
+    struct Push {
+        Operand operand;
+        Location loc;
+
+        Push(Operand operand, Location loc);
+    };
+
+    // Functions not defined in this file are called through the PLT
+    struct Call {
+        std::string name;
+        bool external;
+        Location loc;
+
+        Call(std::string name, bool external, Location loc);
+    };
+
+    // Sets the flags from dst - src
+    struct Cmp {
+        Operand src;
+        Operand dst;
+        Location loc;
+
+        Cmp(Operand src, Operand dst, Location loc);
+    };
+
+    struct Jmp {
+        std::string target;
+        Location loc;
+
+        Jmp(std::string target, Location loc);
+    };
+
+    struct JmpCC {
+        CondCode cond;
+        std::string target;
+        Location loc;
+
+        JmpCC(CondCode cond, std::string target, Location loc);
+    };
+
+    // Sets the low byte of dst to 1 when cond holds and to 0 otherwise,
+    // leaving the rest of it alone
+    struct SetCC {
+        CondCode cond;
+        Operand dst;
+        Location loc;
+
+        SetCC(CondCode cond, Operand dst, Location loc);
+    };
+
+    struct Label {
+        std::string name;
+        Location loc;
+
+        Label(std::string name, Location loc);
+    };
+
+    // Bumps one of the program's profile counters
+    struct IncrementCounter {
+        int counter;
+        Location loc;
+
+        IncrementCounter(int counter, Location loc);
+    };
+
+    using Instr = std::variant<std::monostate, Ret, Mov, Unary, Binary, Lea, Cdq, Idiv, WideMul, 
+        AllocateStack, DeallocateStack, Push, Call, Cmp, Jmp, JmpCC, SetCC, Label, IncrementCounter>;
 
     struct Function {
         std::string identifier;
         std::vector<Instr> instructions;
+        Location loc;
 
-        Function(std::string identifier);
+        Function(std::string identifier, Location loc);
     };
 
     struct Program {
-        Function f;
+        std::vector<Function> functions;
+        std::string source;
+        // Names of the profile counters, and where the program writes them
+        std::vector<std::string> counters;
+        std::string profile_path;
 
-        Program(Function f);
+        Program(std::vector<Function> functions);
     };
 
-    Program lower(const TAC::Program& p);
+    Program lower(TAC::Program&& p, const Passes::Options& opts);
+
+    // Lowers some of a file's functions, where defined names every function
+    // the file defines, so calls to the rest can go straight to them
+    Program lower(TAC::Program&& p, const Passes::Options& opts, const std::unordered_set<std::string>& defined);
 }
 #endif
\ No newline at end of file
@@ -1,27 +1,60 @@
 #include <memory>
 #include <string>
-#include <iostream>
 #include <vector>
 #include <optional>
 #include "ast.hpp"
 
-void Error::syntax_error(int line, int col, std::string_view msg) {
-    std::cout << "Syntax error at line " << line << ", column " << col << ": " << msg << "\n";
-}
-
-AST::Return::Return(AST::Expr exp) : exp(std::move(exp)) {}
+AST::Return::Return(AST::Expr exp, Location loc) : exp(std::move(exp)), loc(loc) {}
 
 AST::Constant::Constant(int val) : val(val) {}
 
-AST::Unary::Unary(AST::Unary::UnOp op, std::unique_ptr<AST::Expr> exp) : op(op), exp(std::move(exp)) {}
+AST::Var::Var(std::string name, Location loc) : name(std::move(name)), loc(loc) {}
+
+AST::Unary::Unary(AST::Unary::UnOp op, std::unique_ptr<AST::Expr> exp, Location loc) : 
+    op(op), exp(std::move(exp)), loc(loc) {}
+
+AST::Binary::Binary(AST::Binary::BinOp op, std::unique_ptr<AST::Expr> lhs, std::unique_ptr<AST::Expr> rhs, Location loc) : 
+    op(op), lhs(std::move(lhs)), rhs(std::move(rhs)), loc(loc) {}
+
+AST::Assignment::Assignment(std::unique_ptr<AST::Expr> lhs, std::unique_ptr<AST::Expr> rhs, Location loc) : 
+    lhs(std::move(lhs)), rhs(std::move(rhs)), loc(loc) {}
+
+AST::FunctionCall::FunctionCall(std::string name, std::vector<std::unique_ptr<AST::Expr>> args, Location loc) : 
+    name(std::move(name)), args(std::move(args)), loc(loc) {}
+
+AST::Expression::Expression(AST::Expr exp) : exp(std::move(exp)) {}
+
+AST::If::If(AST::Expr cond, std::unique_ptr<AST::Stmt> then, std::unique_ptr<AST::Stmt> otherwise, Location loc) : 
+    cond(std::move(cond)), then(std::move(then)), otherwise(std::move(otherwise)), loc(loc) {}
+
+AST::While::While(AST::Expr cond, std::unique_ptr<AST::Stmt> body, Location loc) : 
+    cond(std::move(cond)), body(std::move(body)), loc(loc) {}
+
+AST::Compound::Compound(std::vector<AST::BlockItem> items) : items(std::move(items)) {}
+
+AST::Declaration::Declaration(std::string name, std::optional<AST::Expr> init, Location loc) : 
+    name(std::move(name)), init(std::move(init)), loc(loc) {}
+
+AST::Function::Function(std::string name, std::vector<std::string> params, 
+    std::optional<std::vector<AST::BlockItem>> body, Location loc) : 
+    name(std::move(name)), params(std::move(params)), body(std::move(body)), loc(loc) {}
+
+AST::Program::Program(std::vector<AST::Function> functions) : functions(std::move(functions)) {}
 
-AST::Function::Function(std::string name, AST::Stmt body) : 
-    name(std::move(name)), body(std::move(body)) {}
+AST::Parser::Parser(const std::vector<Token>& tokens, Diagnostics& diagnostics) : 
+    curr(0), tokens(tokens), num_vars(0), diagnostics(diagnostics) {}
 
-AST::Program::Program(AST::Function func_def) : func_def(std::move(func_def)) {}
+AST::Parser::Parser(const std::vector<Token>& tokens, std::unordered_map<std::string, Signature> functions, 
+    Diagnostics& diagnostics) : 
+    curr(0), tokens(tokens), num_vars(0), functions(std::move(functions)), diagnostics(diagnostics) {}
 
-AST::Parser::Parser(const std::vector<Token>& tokens) : 
-    curr(0), tokens(tokens) {}
+void AST::Parser::syntax_error(Location loc, std::string message) {
+    diagnostics.error(Diagnostic::Kind::SYNTAX, loc, std::move(message));
+}
+
+void AST::Parser::semantic_error(Location loc, std::string message) {
+    diagnostics.error(Diagnostic::Kind::SEMANTIC, loc, std::move(message));
+}
 
 
 std::optional<AST::Constant> AST::Parser::parse_int() {
@@ -35,24 +68,79 @@ std::optional<AST::Constant> AST::Parser::parse_int() {
     return node;
 }
 
-std::optional<AST::Expr> AST::Parser::parse_exp() {
+std::optional<AST::Expr> AST::Parser::parse_call() {
+    const Token& name = tokens[curr];
+    curr += 2;
+
+    std::vector<std::unique_ptr<AST::Expr>> args;
+    if (tokens[curr].type != TokenType::TOKEN_CLOSED_PARAN) {
+        while (true) {
+            std::optional<AST::Expr> arg = parse_exp();
+            if (!arg) {
+                return std::nullopt;
+            }
+            args.push_back(std::make_unique<Expr>(std::move(*arg)));
+
+            if (tokens[curr].type != TokenType::TOKEN_COMMA) {
+                break;
+            }
+            ++curr;
+        }
+    }
+
+    if (!expect(TokenType::TOKEN_CLOSED_PARAN, "expected ')'")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    auto it = functions.find(name.lexeme);
+    if (it == functions.end()) {
+        semantic_error(name.loc(), "call to undeclared function '" + name.lexeme + "'");
+        return std::nullopt;
+    }
+    if (it->second.num_params != static_cast<int>(args.size())) {
+        semantic_error(name.loc(), "wrong number of arguments to '" + name.lexeme + "'");
+        return std::nullopt;
+    }
+
+    return AST::FunctionCall(name.lexeme, std::move(args), name.loc());
+}
+
+std::optional<AST::Expr> AST::Parser::parse_factor() {
     const Token& token = tokens[curr];
     switch (token.type) {
         case TokenType::TOKEN_CONSTANT:
             return parse_int();
+        case TokenType::TOKEN_IDENTIFIER: {
+            if (tokens[curr + 1].type == TokenType::TOKEN_OPEN_PARAN) {
+                return parse_call();
+            }
+            ++curr;
+
+            auto it = scope.find(token.lexeme);
+            if (it == scope.end()) {
+                semantic_error(token.loc(), "use of undeclared variable '" + token.lexeme + "'");
+                return std::nullopt;
+            }
+
+            return AST::Var(it->second, token.loc());
+        }
         case TokenType::TOKEN_NEG:
-        case TokenType::TOKEN_TILDE: {
-            AST::Unary::UnOp op = token.type == TokenType::TOKEN_NEG ? AST::Unary::UnOp::NEG : AST::Unary::UnOp::TILDE;
+        case TokenType::TOKEN_TILDE:
+        case TokenType::TOKEN_NOT: {
+            AST::Unary::UnOp op = token.type == TokenType::TOKEN_NEG ? AST::Unary::UnOp::NEG 
+                : token.type == TokenType::TOKEN_TILDE ? AST::Unary::UnOp::TILDE : AST::Unary::UnOp::NOT;
+            Location loc = token.loc();
             ++curr;
 
-            std::optional<AST::Expr> inner_exp = parse_exp();
+            std::optional<AST::Expr> inner_exp = parse_factor();
             if (inner_exp == std::nullopt) {
                 return std::nullopt;
             }
 
             std::unique_ptr<AST::Expr> ptr = std::make_unique<Expr>(std::move(*inner_exp));
 
-            return AST::Unary(op, std::move(ptr));
+            return AST::Unary(op, std::move(ptr), loc);
         }
         case TokenType::TOKEN_OPEN_PARAN: {
             ++curr;
@@ -67,16 +155,185 @@ std::optional<AST::Expr> AST::Parser::parse_exp() {
             return inner_exp;
         }
         default:
-            Error::syntax_error(tokens[curr].line, tokens[curr].col, "Malformed expression");
+            syntax_error(tokens[curr].loc(), "Malformed expression");
             return std::nullopt;
     }
 }
 
-std::optional<AST::Stmt> AST::Parser::parse_statement() {
-    if (!expect(TokenType::TOKEN_RET, "expected return")) {
+// Binding strength of each binary operator, or -1 for tokens that are not one
+int precedence(TokenType type) {
+    switch (type) {
+        case TokenType::TOKEN_STAR:
+        case TokenType::TOKEN_SLASH:
+        case TokenType::TOKEN_PERCENT:
+            return 50;
+        case TokenType::TOKEN_PLUS:
+        case TokenType::TOKEN_NEG:
+            return 45;
+        case TokenType::TOKEN_LESS:
+        case TokenType::TOKEN_LESS_EQUAL:
+        case TokenType::TOKEN_GREATER:
+        case TokenType::TOKEN_GREATER_EQUAL:
+            return 35;
+        case TokenType::TOKEN_EQUAL:
+        case TokenType::TOKEN_NOT_EQUAL:
+            return 30;
+        case TokenType::TOKEN_AND:
+            return 10;
+        case TokenType::TOKEN_OR:
+            return 5;
+        case TokenType::TOKEN_ASSIGN:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+AST::Binary::BinOp convert_binop(TokenType type) {
+    switch (type) {
+        case TokenType::TOKEN_PLUS: return AST::Binary::BinOp::ADD;
+        case TokenType::TOKEN_NEG: return AST::Binary::BinOp::SUB;
+        case TokenType::TOKEN_STAR: return AST::Binary::BinOp::MUL;
+        case TokenType::TOKEN_SLASH: return AST::Binary::BinOp::DIV;
+        case TokenType::TOKEN_PERCENT: return AST::Binary::BinOp::MOD;
+        case TokenType::TOKEN_LESS: return AST::Binary::BinOp::LT;
+        case TokenType::TOKEN_LESS_EQUAL: return AST::Binary::BinOp::LE;
+        case TokenType::TOKEN_GREATER: return AST::Binary::BinOp::GT;
+        case TokenType::TOKEN_GREATER_EQUAL: return AST::Binary::BinOp::GE;
+        case TokenType::TOKEN_EQUAL: return AST::Binary::BinOp::EQ;
+        case TokenType::TOKEN_NOT_EQUAL: return AST::Binary::BinOp::NE;
+        case TokenType::TOKEN_AND: return AST::Binary::BinOp::AND;
+        default: return AST::Binary::BinOp::OR;
+    }
+}
+
+std::optional<AST::Expr> AST::Parser::parse_exp(int min_prec) {
+    std::optional<AST::Expr> lhs = parse_factor();
+
+    while (lhs && precedence(tokens[curr].type) >= min_prec) {
+        const Token& op = tokens[curr];
+        int prec = precedence(op.type);
+        ++curr;
+
+        if (op.type == TokenType::TOKEN_ASSIGN) {
+            if (!std::holds_alternative<AST::Var>(*lhs)) {
+                semantic_error(op.loc(), "left side of assignment is not a variable");
+                return std::nullopt;
+            }
+
+            // Assignment is right associative
+            std::optional<AST::Expr> rhs = parse_exp(prec);
+            if (!rhs) {
+                return std::nullopt;
+            }
+            lhs = AST::Assignment(std::make_unique<Expr>(std::move(*lhs)), std::make_unique<Expr>(std::move(*rhs)), op.loc());
+            continue;
+        }
+
+        std::optional<AST::Expr> rhs = parse_exp(prec + 1);
+        if (!rhs) {
+            return std::nullopt;
+        }
+
+        lhs = AST::Binary(convert_binop(op.type), std::make_unique<Expr>(std::move(*lhs)), std::make_unique<Expr>(std::move(*rhs)), op.loc());
+    }
+
+    return lhs;
+}
+
+std::optional<AST::Expr> AST::Parser::parse_condition() {
+    if (!expect(TokenType::TOKEN_OPEN_PARAN, "expected '('")) {
         return std::nullopt;
     }
     ++curr;
+
+    std::optional<AST::Expr> cond = parse_exp();
+    if (!cond || !expect(TokenType::TOKEN_CLOSED_PARAN, "expected ')'")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    return cond;
+}
+
+std::optional<AST::Stmt> AST::Parser::parse_if() {
+    Location loc = tokens[curr].loc();
+    ++curr;
+
+    std::optional<AST::Expr> cond = parse_condition();
+    if (!cond) {
+        return std::nullopt;
+    }
+
+    std::optional<AST::Stmt> then = parse_statement();
+    if (!then) {
+        return std::nullopt;
+    }
+
+    std::unique_ptr<AST::Stmt> otherwise;
+    if (tokens[curr].type == TokenType::TOKEN_ELSE) {
+        ++curr;
+        std::optional<AST::Stmt> stmt = parse_statement();
+        if (!stmt) {
+            return std::nullopt;
+        }
+        otherwise = std::make_unique<Stmt>(std::move(*stmt));
+    }
+
+    return AST::If(std::move(*cond), std::make_unique<Stmt>(std::move(*then)), std::move(otherwise), loc);
+}
+
+std::optional<AST::Stmt> AST::Parser::parse_while() {
+    Location loc = tokens[curr].loc();
+    ++curr;
+
+    std::optional<AST::Expr> cond = parse_condition();
+    if (!cond) {
+        return std::nullopt;
+    }
+
+    std::optional<AST::Stmt> body = parse_statement();
+    if (!body) {
+        return std::nullopt;
+    }
+
+    return AST::While(std::move(*cond), std::make_unique<Stmt>(std::move(*body)), loc);
+}
+
+std::optional<AST::Stmt> AST::Parser::parse_statement() {
+    switch (tokens[curr].type) {
+        case TokenType::TOKEN_SEMI:
+            ++curr;
+            return AST::Null{};
+        case TokenType::TOKEN_IF:
+            return parse_if();
+        case TokenType::TOKEN_WHILE:
+            return parse_while();
+        case TokenType::TOKEN_OPEN_BRACE: {
+            // Inner declarations shadow outer ones until the block ends
+            auto outer_scope = scope;
+            auto outer_block = std::move(block_vars);
+            block_vars.clear();
+
+            std::optional<std::vector<AST::BlockItem>> items = parse_block();
+
+            scope = std::move(outer_scope);
+            block_vars = std::move(outer_block);
+
+            if (!items) {
+                return std::nullopt;
+            }
+            return AST::Compound(std::move(*items));
+        }
+        default:
+            break;
+    }
+
+    bool is_return = tokens[curr].type == TokenType::TOKEN_RET;
+    Location loc = tokens[curr].loc();
+    if (is_return) {
+        ++curr;
+    }
     
     std::optional<AST::Expr> exp = parse_exp();
     
@@ -85,7 +342,128 @@ std::optional<AST::Stmt> AST::Parser::parse_statement() {
     }
     ++curr;
 
-    return AST::Return(std::move(*exp));
+    if (is_return) {
+        return AST::Return(std::move(*exp), loc);
+    }
+    return AST::Expression(std::move(*exp));
+}
+
+std::optional<AST::Declaration> AST::Parser::parse_declaration() {
+    if (!expect(TokenType::TOKEN_INT, "expected 'int'")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    if (!expect(TokenType::TOKEN_IDENTIFIER, "expected identifier")) {
+        return std::nullopt;
+    }
+    const Token& name = tokens[curr];
+    ++curr;
+
+    // The variable is in scope in its own initializer, as in C
+    std::optional<std::string> unique_name = declare_var(name);
+    if (!unique_name) {
+        return std::nullopt;
+    }
+
+    std::optional<AST::Expr> init;
+    if (tokens[curr].type == TokenType::TOKEN_ASSIGN) {
+        ++curr;
+
+        init = parse_exp();
+        if (!init) {
+            return std::nullopt;
+        }
+    }
+
+    if (!expect(TokenType::TOKEN_SEMI, "expected semicolon")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    return AST::Declaration(std::move(*unique_name), std::move(init), name.loc());
+}
+
+std::optional<AST::BlockItem> AST::Parser::parse_block_item() {
+    if (tokens[curr].type == TokenType::TOKEN_INT) {
+        std::optional<AST::Declaration> decl = parse_declaration();
+        if (!decl) {
+            return std::nullopt;
+        }
+        return std::move(*decl);
+    }
+
+    std::optional<AST::Stmt> stmt = parse_statement();
+    if (!stmt) {
+        return std::nullopt;
+    }
+    return std::move(*stmt);
+}
+
+std::optional<std::string> AST::Parser::declare_var(const Token& name) {
+    if (!block_vars.insert(name.lexeme).second) {
+        semantic_error(name.loc(), "redeclaration of '" + name.lexeme + "'");
+        return std::nullopt;
+    }
+
+    std::string unique_name = name.lexeme + "." + std::to_string(num_vars++);
+    scope[name.lexeme] = unique_name;
+    return unique_name;
+}
+
+std::optional<std::vector<AST::BlockItem>> AST::Parser::parse_block() {
+    if (!expect(TokenType::TOKEN_OPEN_BRACE, "expected '{'")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    std::vector<AST::BlockItem> items;
+    while (tokens[curr].type != TokenType::TOKEN_CLOSED_BRACE && tokens[curr].type != TokenType::TOKEN_EOF) {
+        std::optional<AST::BlockItem> item = parse_block_item();
+        if (!item) {
+            synchronize(true);
+            continue;
+        }
+        items.push_back(std::move(*item));
+    }
+    
+    if (!expect(TokenType::TOKEN_CLOSED_BRACE, "expected '}'")) {
+        return std::nullopt;
+    }
+    ++curr;
+
+    return items;
+}
+
+std::optional<std::vector<std::string>> AST::Parser::parse_params() {
+    std::vector<std::string> params;
+
+    if (tokens[curr].type == TokenType::TOKEN_VOID) {
+        ++curr;
+        return params;
+    }
+
+    while (true) {
+        if (!expect(TokenType::TOKEN_INT, "expected 'int' or 'void'")) {
+            return std::nullopt;
+        }
+        ++curr;
+
+        if (!expect(TokenType::TOKEN_IDENTIFIER, "expected identifier")) {
+            return std::nullopt;
+        }
+        std::optional<std::string> param = declare_var(tokens[curr]);
+        if (!param) {
+            return std::nullopt;
+        }
+        params.push_back(std::move(*param));
+        ++curr;
+
+        if (tokens[curr].type != TokenType::TOKEN_COMMA) {
+            return params;
+        }
+        ++curr;
+    }
 }
 
 std::optional<AST::Function> AST::Parser::parse_function() {
@@ -98,6 +476,7 @@ std::optional<AST::Function> AST::Parser::parse_function() {
         return std::nullopt;
     }
     std::string name = tokens[curr].lexeme;
+    Location loc = tokens[curr].loc();
     ++curr;
 
     if (!expect(TokenType::TOKEN_OPEN_PARAN, "expected '('")) {
@@ -105,49 +484,94 @@ std::optional<AST::Function> AST::Parser::parse_function() {
     }
     ++curr;
 
-    if (!expect(TokenType::TOKEN_VOID, "expected 'void'")) {
+    // Each function starts with only its parameters in scope, and they
+    // share a block with the body
+    scope.clear();
+    block_vars.clear();
+
+    std::optional<std::vector<std::string>> params = parse_params();
+    if (!params) {
         return std::nullopt;
     }
-    ++curr;
 
     if (!expect(TokenType::TOKEN_CLOSED_PARAN, "expected ')'")) {
         return std::nullopt;
     }
     ++curr;
 
-    if (!expect(TokenType::TOKEN_OPEN_BRACE, "expected '{'")) {
+    bool has_body = tokens[curr].type == TokenType::TOKEN_OPEN_BRACE;
+    auto [it, inserted] = functions.try_emplace(name, Signature{static_cast<int>(params->size()), false});
+
+    if (!inserted && it->second.num_params != static_cast<int>(params->size())) {
+        semantic_error(loc, "conflicting declaration of '" + name + "'");
         return std::nullopt;
     }
-    ++curr;
+    if (has_body && it->second.defined) {
+        semantic_error(loc, "redefinition of '" + name + "'");
+        return std::nullopt;
+    }
+    it->second.defined |= has_body;
 
-    std::optional<AST::Stmt> body = parse_statement();
-    
-    if (!body || !expect(TokenType::TOKEN_CLOSED_BRACE, "expected '}'")) {
+    if (!has_body) {
+        if (!expect(TokenType::TOKEN_SEMI, "expected ';' or '{'")) {
+            return std::nullopt;
+        }
+        ++curr;
+
+        return AST::Function(std::move(name), std::move(*params), std::nullopt, loc);
+    }
+
+    std::optional<std::vector<AST::BlockItem>> body = parse_block();
+    if (!body) {
         return std::nullopt;
     }
-    ++curr;
 
-    return AST::Function(std::move(name), std::move(*body));
+    return AST::Function(std::move(name), std::move(*params), std::move(*body), loc);
 }
 
 std::optional<AST::Program> AST::Parser::parse_program() {
-    std::optional<AST::Function> func_def = parse_function();
-    if (!func_def) {
-        return std::nullopt;
-    }
+    std::vector<AST::Function> functions;
+
+    size_t errors = diagnostics.size();
+
+    // ISO C does not allow an empty translation unit
+    do {
+        std::optional<AST::Function> func = parse_function();
+        if (!func) {
+            synchronize(false);
+            continue;
+        }
+        functions.push_back(std::move(*func));
+    } while (tokens[curr].type != TokenType::TOKEN_EOF);
 
-    if (curr < tokens.size() - 1) {
-        Error::syntax_error(tokens[curr].line, tokens[curr].col, "expected program end");
+    if (diagnostics.size() > errors) {
         return std::nullopt;
     }
+    return AST::Program(std::move(functions));
+}
+
+void AST::Parser::synchronize(bool in_block) {
+    int depth {};
+    while (tokens[curr].type != TokenType::TOKEN_EOF) {
+        TokenType type = tokens[curr].type;
+        if (in_block && depth == 0 && type == TokenType::TOKEN_CLOSED_BRACE) {
+            return;
+        }
+        ++curr;
 
-    return AST::Program(std::move(*func_def));
+        if (type == TokenType::TOKEN_OPEN_BRACE) {
+            ++depth;
+        } else if ((type == TokenType::TOKEN_CLOSED_BRACE && --depth <= 0) 
+                || (type == TokenType::TOKEN_SEMI && depth == 0)) {
+            return;
+        }
+    }
 }
 
 bool AST::Parser::expect(TokenType expected, std::string_view msg) {
     const Token &actual = tokens[curr];
     if (actual.type != expected) {
-        Error::syntax_error(actual.line, actual.col, msg);
+        syntax_error(actual.loc(), std::string(msg));
         return false;
     }
     return true;
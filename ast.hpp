@@ -6,11 +6,10 @@
 #include <vector>
 #include <variant>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
 #include "lexer.hpp"
-
-namespace Error {
-    static void syntax_error(int line, int col, std::string_view msg);
-};
+#include "diagnostics.hpp"
 
 namespace AST {    
     struct Constant {
@@ -19,55 +18,195 @@ namespace AST {
         Constant(int val);
     };
 
-    using Expr = std::variant<std::monostate, Constant, struct Unary>;
+    struct Var {
+        std::string name;
+        Location loc;
+
+        Var(std::string name, Location loc);
+    };
+
+    using Expr = std::variant<std::monostate, Constant, Var, struct Unary, struct Binary, struct Assignment, 
+        struct FunctionCall>;
 
     struct Unary {
-        enum class UnOp { NEG, TILDE };
+        enum class UnOp { NEG, TILDE, NOT };
 
         UnOp op;
         std::unique_ptr<Expr> exp;
+        Location loc;
+
+        Unary(Unary::UnOp op, std::unique_ptr<Expr> exp, Location loc);
+    };
 
-        Unary(Unary::UnOp op, std::unique_ptr<Expr> exp);
+    // && and || only evaluate rhs when lhs does not already decide the result
+    struct Binary {
+        enum class BinOp { ADD, SUB, MUL, DIV, MOD, LT, LE, GT, GE, EQ, NE, AND, OR };
+
+        BinOp op;
+        std::unique_ptr<Expr> lhs;
+        std::unique_ptr<Expr> rhs;
+        Location loc;
+
+        Binary(Binary::BinOp op, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs, Location loc);
     };
 
-    using Expr = std::variant<std::monostate, Constant, Unary>;
+    struct Assignment {
+        std::unique_ptr<Expr> lhs;
+        std::unique_ptr<Expr> rhs;
+        Location loc;
+
+        Assignment(std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs, Location loc);
+    };
+
+    struct FunctionCall {
+        std::string name;
+        std::vector<std::unique_ptr<Expr>> args;
+        Location loc;
+
+        FunctionCall(std::string name, std::vector<std::unique_ptr<Expr>> args, Location loc);
+    };
+
+    using Expr = std::variant<std::monostate, Constant, Var, Unary, Binary, Assignment, FunctionCall>;
 
     struct Return {
         Expr exp;
+        Location loc;
+
+        Return(Expr exp, Location loc);
+    };
+
+    struct Expression {
+        Expr exp;
+
+        Expression(Expr exp);
+    };
+
+    struct Null {};
+
+    using Stmt = std::variant<std::monostate, Return, Expression, Null, struct If, struct While, struct Compound>;
+
+    struct Declaration {
+        std::string name;
+        std::optional<Expr> init;
+        Location loc;
+
+        Declaration(std::string name, std::optional<Expr> init, Location loc);
+    };
+
+    using BlockItem = std::variant<std::monostate, Stmt, Declaration>;
 
-        Return(Expr exp);
+    struct If {
+        Expr cond;
+        std::unique_ptr<Stmt> then;
+        // Null when there is no else branch
+        std::unique_ptr<Stmt> otherwise;
+        Location loc;
+
+        If(Expr cond, std::unique_ptr<Stmt> then, std::unique_ptr<Stmt> otherwise, Location loc);
     };
 
-    using Stmt = std::variant<std::monostate, Return>;
+    struct While {
+        Expr cond;
+        std::unique_ptr<Stmt> body;
+        Location loc;
+
+        While(Expr cond, std::unique_ptr<Stmt> body, Location loc);
+    };
+
+    struct Compound {
+        std::vector<BlockItem> items;
+
+        Compound(std::vector<BlockItem> items);
+    };
 
+    // A function without a body is a declaration of a function defined elsewhere
     struct Function {
         std::string name;
-        Stmt body;
+        std::vector<std::string> params;
+        std::optional<std::vector<BlockItem>> body;
+        Location loc;
 
-        Function(std::string name, Stmt body);
+        Function(std::string name, std::vector<std::string> params, 
+            std::optional<std::vector<BlockItem>> body, Location loc);
     };
 
     struct Program {
-        Function func_def;
+        std::vector<Function> functions;
 
-        Program(Function func_def); 
+        Program(std::vector<Function> functions); 
     };
 
     class Parser {
+    public:
+        struct Signature {
+            int num_params;
+            bool defined;
+        };
+
+    private:
         int curr;
         const std::vector<Token>& tokens;
 
+        // Variables in scope, mapped to the unique names they are renamed to,
+        // and the ones declared in the innermost block, which may not be
+        // declared again
+        std::unordered_map<std::string, std::string> scope;
+        std::unordered_set<std::string> block_vars;
+        int num_vars;
+
+        std::unordered_map<std::string, Signature> functions;
+
+        Diagnostics& diagnostics;
+
+        std::optional<std::string> declare_var(const Token& name);
+
+        void syntax_error(Location loc, std::string message);
+
+        void semantic_error(Location loc, std::string message);
+
+        // Panic mode: skips the rest of a construct that failed to parse, up
+        // to just past the next ';' or the '}' closing a block opened on the
+        // way. Inside a block, a '}' closing the block itself is left for it.
+        void synchronize(bool in_block);
+
     public:
-        Parser(const std::vector<Token>& tokens);
+        // Errors are added to diagnostics, and parsing goes on after them
+        Parser(const std::vector<Token>& tokens, Diagnostics& diagnostics);
+
+        // Starts out knowing the functions declared earlier in the file, for
+        // parsing one function on its own
+        Parser(const std::vector<Token>& tokens, std::unordered_map<std::string, Signature> functions, 
+            Diagnostics& diagnostics);
 
         std::optional<Constant> parse_int();
 
-        std::optional<Expr> parse_exp();
+        std::optional<Expr> parse_call();
+
+        std::optional<Expr> parse_factor();
+
+        // Parses operators binding at least as tightly as min_prec
+        std::optional<Expr> parse_exp(int min_prec = 0);
 
         std::optional<Stmt> parse_statement();
 
+        // Parses the parenthesized condition of an if or while
+        std::optional<Expr> parse_condition();
+
+        std::optional<Stmt> parse_if();
+
+        std::optional<Stmt> parse_while();
+
+        std::optional<std::vector<BlockItem>> parse_block();
+
+        std::optional<Declaration> parse_declaration();
+
+        std::optional<BlockItem> parse_block_item();
+
+        std::optional<std::vector<std::string>> parse_params();
+
         std::optional<Function> parse_function();
 
+        // Fails when any error was found
         std::optional<Program> parse_program();
 
         bool expect(TokenType expected, std::string_view msg);
@@ -0,0 +1,238 @@
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "tac.hpp"
+#include "cfg.hpp"
+
+CFG::Graph::Graph(const TAC::Function& f) : succs(f.blocks.size()), preds(f.blocks.size()) {
+    for (size_t b = 0; b < f.blocks.size(); ++b) {
+        succs[b] = TAC::successors(f.blocks[b]);
+        for (size_t s : succs[b]) {
+            preds[s].push_back(b);
+        }
+    }
+}
+
+// FNV-1a over the successors of every block
+uint64_t CFG::shape(const CFG::Graph& g) {
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&hash](uint64_t word) -> void {
+        hash = (hash ^ word) * 0x100000001b3;
+    };
+
+    mix(g.succs.size());
+    for (const auto& succs : g.succs) {
+        mix(succs.size());
+        for (size_t s : succs) {
+            mix(s);
+        }
+    }
+    return hash;
+}
+
+void CFG::mark_origins(TAC::Function& f) {
+    for (const auto& block : f.blocks) {
+        if (block.origin) {
+            return;
+        }
+    }
+
+    uint64_t id = shape(CFG::Graph(f));
+    for (size_t b = 0; b < f.blocks.size(); ++b) {
+        f.blocks[b].origin = TAC::Origin{ f.identifier, id, b };
+    }
+}
+
+std::vector<size_t> CFG::reverse_postorder(const CFG::Graph& g) {
+    std::vector<size_t> order;
+    if (g.succs.empty()) {
+        return order;
+    }
+
+    // Iterative so that long chains of blocks cannot overflow the stack;
+    // each entry is a block and the next successor to visit
+    std::vector<bool> visited(g.succs.size());
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.emplace_back(0, 0);
+    visited[0] = true;
+
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+        if (next < g.succs[b].size()) {
+            size_t s = g.succs[b][next++];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack.emplace_back(s, 0);
+            }
+            continue;
+        }
+
+        order.push_back(b);
+        stack.pop_back();
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm: idoms are refined in
+// reverse postorder until they stop changing, which for reducible graphs
+// takes two passes
+CFG::Dominators::Dominators(const CFG::Graph& g) : idom(g.succs.size(), CFG::NONE) {
+    std::vector<size_t> order = CFG::reverse_postorder(g);
+    if (order.empty()) {
+        return;
+    }
+
+    std::vector<size_t> rpo_index(g.succs.size(), CFG::NONE);
+    for (size_t idx = 0; idx < order.size(); ++idx) {
+        rpo_index[order[idx]] = idx;
+    }
+
+    auto intersect = [this, &rpo_index](size_t a, size_t b) -> size_t {
+        while (a != b) {
+            while (rpo_index[a] > rpo_index[b]) {
+                a = idom[a];
+            }
+            while (rpo_index[b] > rpo_index[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+
+    idom[order[0]] = order[0];
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t idx = 1; idx < order.size(); ++idx) {
+            size_t b = order[idx];
+            size_t new_idom = CFG::NONE;
+            for (size_t p : g.preds[b]) {
+                if (idom[p] == CFG::NONE) {
+                    continue;
+                }
+                new_idom = new_idom == CFG::NONE ? p : intersect(p, new_idom);
+            }
+
+            if (idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    children.resize(g.succs.size());
+    for (size_t b = 0; b < g.succs.size(); ++b) {
+        if (idom[b] != CFG::NONE && idom[b] != b) {
+            children[idom[b]].push_back(b);
+        }
+    }
+
+    // Iterative for the same reason as reverse_postorder
+    entered.assign(g.succs.size(), CFG::NONE);
+    left.assign(g.succs.size(), CFG::NONE);
+    size_t clock {};
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.emplace_back(order[0], 0);
+    entered[order[0]] = clock++;
+
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+        if (next < children[b].size()) {
+            size_t c = children[b][next++];
+            entered[c] = clock++;
+            stack.emplace_back(c, 0);
+            continue;
+        }
+
+        left[b] = clock++;
+        stack.pop_back();
+    }
+
+    // Cooper, Harvey and Kennedy again: a join is in the frontier of each
+    // block from its predecessors up to, but not including, its idom. The
+    // entry is also entered from outside the function, and since nothing
+    // strictly dominates it, the walk up to it includes the entry itself.
+    size_t entry = order[0];
+    frontier.resize(g.succs.size());
+    for (size_t b : order) {
+        if (g.preds[b].size() + (b == entry) < 2) {
+            continue;
+        }
+
+        for (size_t p : g.preds[b]) {
+            size_t runner = p;
+            while (idom[runner] != CFG::NONE && (runner != idom[b] || b == entry)) {
+                // Another predecessor's walk already went on from here
+                if (!frontier[runner].empty() && frontier[runner].back() == b) {
+                    break;
+                }
+                frontier[runner].push_back(b);
+                if (runner == entry) {
+                    break;
+                }
+                runner = idom[runner];
+            }
+        }
+    }
+}
+
+bool CFG::Dominators::dominates(size_t a, size_t b) const {
+    if (idom[a] == CFG::NONE || idom[b] == CFG::NONE) {
+        return false;
+    }
+
+    return entered[a] <= entered[b] && left[b] <= left[a];
+}
+
+CFG::Loops::Loops(const CFG::Graph& g, const CFG::Dominators& dom) : depth(g.succs.size()) {
+    std::vector<size_t> loop_of(g.succs.size(), CFG::NONE);
+
+    for (size_t b = 0; b < g.succs.size(); ++b) {
+        for (size_t h : g.succs[b]) {
+            if (!dom.dominates(h, b)) {
+                continue;
+            }
+
+            // Back edges into the same header share one loop
+            if (loop_of[h] == CFG::NONE) {
+                loop_of[h] = loops.size();
+                loops.push_back(CFG::Loop{h, {h}});
+            }
+            CFG::Loop& loop = loops[loop_of[h]];
+
+            // The body is everything that reaches the back edge without
+            // going through the header
+            std::vector<bool> in_loop(g.succs.size());
+            for (size_t l : loop.blocks) {
+                in_loop[l] = true;
+            }
+
+            std::vector<size_t> work;
+            if (!in_loop[b]) {
+                in_loop[b] = true;
+                loop.blocks.push_back(b);
+                work.push_back(b);
+            }
+
+            while (!work.empty()) {
+                size_t w = work.back();
+                work.pop_back();
+                for (size_t p : g.preds[w]) {
+                    if (!in_loop[p] && dom.idom[p] != CFG::NONE) {
+                        in_loop[p] = true;
+                        loop.blocks.push_back(p);
+                        work.push_back(p);
+                    }
+                }
+            }
+        }
+    }
+
+    for (const auto& loop : loops) {
+        for (size_t b : loop.blocks) {
+            ++depth[b];
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <cstdint>
+#include <vector>
+#include "tac.hpp"
+
+// Control flow analyses of a TAC function. Blocks are referred to by their
+// index in the function, and the entry is always block 0.
+namespace CFG {
+    static constexpr size_t NONE = SIZE_MAX;
+
+    struct Graph {
+        std::vector<std::vector<size_t>> succs;
+        std::vector<std::vector<size_t>> preds;
+
+        Graph(const TAC::Function& f);
+    };
+
+    // Identifies the shape of a control flow graph, the same in every build
+    uint64_t shape(const Graph& g);
+
+    // Gives every block of f its own number as its origin, unless some
+    // block already has one
+    void mark_origins(TAC::Function& f);
+
+    // The blocks reachable from the entry, each one before its successors
+    // except along back edges
+    std::vector<size_t> reverse_postorder(const Graph& g);
+
+    struct Dominators {
+        // Immediate dominator of each block; the entry is its own, and
+        // unreachable blocks have NONE
+        std::vector<size_t> idom;
+        // The blocks each block immediately dominates, in increasing order
+        std::vector<std::vector<size_t>> children;
+        // The blocks where each block's dominance ends: those it does not
+        // strictly dominate but has a predecessor of, which is where values
+        // defined in it meet values from elsewhere
+        std::vector<std::vector<size_t>> frontier;
+
+        Dominators(const Graph& g);
+
+        // In constant time, from when a and b are entered and left in a
+        // walk of the dominator tree
+        bool dominates(size_t a, size_t b) const;
+
+    private:
+        std::vector<size_t> entered;
+        std::vector<size_t> left;
+    };
+
+    // A natural loop: the header dominates every block in it, and one or
+    // more back edges lead from the body to the header
+    struct Loop {
+        size_t header;
+        std::vector<size_t> blocks;
+    };
+
+    struct Loops {
+        std::vector<Loop> loops;
+        // How many loops each block is in, 0 for blocks outside all loops
+        std::vector<int> depth;
+
+        Loops(const Graph& g, const Dominators& dom);
+    };
+}
+
+#endif
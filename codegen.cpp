@@ -1,7 +1,10 @@
+#include <cstdint>
 #include <fstream>
 #include <variant>
+#include <type_traits>
 #include "codegen.hpp"
 #include "asmtree.hpp"
+#include "profile.hpp"
 
 template<class... Ts> struct overloaded : Ts... { 
     using Ts::operator()...; 
@@ -9,12 +12,23 @@ template<class... Ts> struct overloaded : Ts... {
 
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-std::string format(const ASMTree::Operand& op) {
+// Registers are named by their form of the given size in bytes: 1, 4 or 8
+std::string format(const ASMTree::Operand& op, int size = 4) {
     return std::visit(overloaded {
-        [](const ASMTree::Reg& r) -> std::string {
+        [size](const ASMTree::Reg& r) -> std::string {
+            auto pick = [size](const char* byte, const char* dword, const char* qword) -> std::string {
+                return size == 1 ? byte : size == 8 ? qword : dword;
+            };
             switch(r.r) {
-                case ASMTree::Reg::reg::AX: return "%eax";
-                case ASMTree::Reg::reg::R10: return "%r10d";
+                case ASMTree::Reg::reg::AX: return pick("%al", "%eax", "%rax");
+                case ASMTree::Reg::reg::CX: return pick("%cl", "%ecx", "%rcx");
+                case ASMTree::Reg::reg::DX: return pick("%dl", "%edx", "%rdx");
+                case ASMTree::Reg::reg::DI: return pick("%dil", "%edi", "%rdi");
+                case ASMTree::Reg::reg::SI: return pick("%sil", "%esi", "%rsi");
+                case ASMTree::Reg::reg::R8: return pick("%r8b", "%r8d", "%r8");
+                case ASMTree::Reg::reg::R9: return pick("%r9b", "%r9d", "%r9");
+                case ASMTree::Reg::reg::R10: return pick("%r10b", "%r10d", "%r10");
+                case ASMTree::Reg::reg::R11: return pick("%r11b", "%r11d", "%r11");
                 default: return "unknown";
             }
         },
@@ -31,13 +45,138 @@ std::string format(const ASMTree::Operand& op) {
     }, op);
 }
 
-void Emitter::emit(const ASMTree::Program& node, std::ostream& out) {
-    out << "    .globl " << node.f.identifier << "\n";
-    out << node.f.identifier << ":\n";
+// Addresses are formed from the 8-byte registers
+std::string format(const ASMTree::Lea& l) {
+    std::string address = l.disp ? std::to_string(l.disp) : "";
+    address += "(";
+    if (!std::holds_alternative<std::monostate>(l.base)) {
+        address += format(l.base, 8);
+    }
+    if (!std::holds_alternative<std::monostate>(l.index)) {
+        address += "," + format(l.index, 8) + "," + std::to_string(l.scale);
+    }
+    return address + ")";
+}
+
+std::string suffix(ASMTree::CondCode cond) {
+    switch (cond) {
+        case ASMTree::CondCode::E: return "e";
+        case ASMTree::CondCode::NE: return "ne";
+        case ASMTree::CondCode::L: return "l";
+        case ASMTree::CondCode::LE: return "le";
+        case ASMTree::CondCode::G: return "g";
+        case ASMTree::CondCode::GE: return "ge";
+    }
+    return "";
+}
+
+std::string quote(const std::string& s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+Location location(const ASMTree::Instr& instr) {
+    return std::visit([](const auto& i) -> Location {
+        if constexpr (std::is_same_v<std::decay_t<decltype(i)>, std::monostate>) {
+            return Location{};
+        } else {
+            return i.loc;
+        }
+    }, instr);
+}
+
+void emit_loc(const Location& loc, Location& last, std::ostream& out) {
+    if (loc.line < 0 || (loc.line == last.line && loc.col == last.col)) {
+        return;
+    }
+
+    // Tokens count lines and columns from 0, DWARF from 1
+    out << "    .loc 1 " << loc.line + 1 << " " << loc.col + 1 << "\n";
+    last = loc;
+}
+
+// Counters live in .bss; a .fini_array hook writes them out at exit with raw
+// syscalls, so instrumented programs need nothing beyond the usual crt
+void emit_profile_runtime(const ASMTree::Program& node, std::ostream& out) {
+    size_t names_size {};
+    for (const auto& name : node.counters) {
+        names_size += name.size() + 1;
+    }
+    size_t header_size = sizeof(Profile::MAGIC) + 2 * sizeof(uint64_t) + names_size;
+    size_t counters_size = node.counters.size() * sizeof(uint64_t);
+
+    out << "    .text\n";
+    out << ".Lttc_profile_dump:\n";
+    out << "    pushq    %rbx\n";
+    out << "    movl    $2, %eax\n";
+    out << "    leaq    .Lttc_profile_path(%rip), %rdi\n";
+    out << "    movl    $577, %esi\n"; // O_WRONLY | O_CREAT | O_TRUNC
+    out << "    movl    $420, %edx\n"; // 0644
+    out << "    syscall\n";
+    out << "    testl    %eax, %eax\n";
+    out << "    js    .Lttc_profile_done\n";
+    out << "    movl    %eax, %ebx\n";
+    out << "    movl    $1, %eax\n";
+    out << "    movl    %ebx, %edi\n";
+    out << "    leaq    .Lttc_profile_header(%rip), %rsi\n";
+    out << "    movl    $" << header_size << ", %edx\n";
+    out << "    syscall\n";
+    out << "    movl    $1, %eax\n";
+    out << "    movl    %ebx, %edi\n";
+    out << "    leaq    .Lttc_profile_counters(%rip), %rsi\n";
+    out << "    movl    $" << counters_size << ", %edx\n";
+    out << "    syscall\n";
+    out << "    movl    $3, %eax\n";
+    out << "    movl    %ebx, %edi\n";
+    out << "    syscall\n";
+    out << ".Lttc_profile_done:\n";
+    out << "    popq    %rbx\n";
+    out << "    ret\n";
+
+    out << "    .section .rodata\n";
+    out << ".Lttc_profile_header:\n";
+    out << "    .ascii " << quote(std::string(Profile::MAGIC, sizeof(Profile::MAGIC))) << "\n";
+    out << "    .quad " << node.counters.size() << "\n";
+    out << "    .quad " << names_size << "\n";
+    for (const auto& name : node.counters) {
+        out << "    .asciz " << quote(name) << "\n";
+    }
+    out << ".Lttc_profile_path:\n";
+    out << "    .asciz " << quote(node.profile_path) << "\n";
+
+    out << "    .bss\n";
+    out << "    .align 8\n";
+    out << ".Lttc_profile_counters:\n";
+    out << "    .zero " << counters_size << "\n";
+
+    out << "    .section .fini_array,\"aw\"\n";
+    out << "    .align 8\n";
+    out << "    .quad .Lttc_profile_dump\n";
+}
+
+void emit(const ASMTree::Function& f, std::ostream& out, bool debug, Location& last) {
+    out << "    .globl " << f.identifier << "\n";
+    out << f.identifier << ":\n";
+    if (debug) {
+        emit_loc(f.loc, last, out);
+    }
     out << "    pushq    %rbp\n";
     out << "    movq    %rsp, %rbp\n";
 
-    for (const auto& instr : node.f.instructions) {
+    for (const auto& instr : f.instructions) {
+        if (debug) {
+            emit_loc(location(instr), last, out);
+        }
+        if (const auto* l = std::get_if<ASMTree::Label>(&instr)) {
+            out << l->name << ":\n";
+            continue;
+        }
         out << "    ";
         std::visit(overloaded {
             [&out](const ASMTree::Mov& m) -> void {
@@ -61,10 +200,100 @@ void Emitter::emit(const ASMTree::Program& node, std::ostream& out) {
                 }
                 out << format(u.operand) << "\n";
             },
+            [&out](const ASMTree::Binary& b) -> void {
+                switch (b.op) {
+                    case ASMTree::Binary::BinOp::ADD:
+                        out << "addl    ";
+                        break;
+                    case ASMTree::Binary::BinOp::SUB:
+                        out << "subl    ";
+                        break;
+                    case ASMTree::Binary::BinOp::MULT:
+                        out << "imull    ";
+                        break;
+                    case ASMTree::Binary::BinOp::SHL:
+                        out << "sall    ";
+                        break;
+                    case ASMTree::Binary::BinOp::SAR:
+                        out << "sarl    ";
+                        break;
+                    case ASMTree::Binary::BinOp::SHR:
+                        out << "shrl    ";
+                        break;
+                }
+                out << format(b.src) << ", " << format(b.dst) << "\n";
+            },
+            [&out](const ASMTree::Lea& l) -> void {
+                out << "leal    " << format(l) << ", " << format(l.dst) << "\n";
+            },
+            [&out](const ASMTree::Cdq&) -> void {
+                out << "cdq\n";
+            },
+            [&out](const ASMTree::Idiv& i) -> void {
+                out << "idivl    " << format(i.operand) << "\n";
+            },
+            [&out](const ASMTree::WideMul& m) -> void {
+                out << "imull    " << format(m.operand) << "\n";
+            },
             [&out](const ASMTree::AllocateStack& as) -> void {
                 out << "subq    $" << as.amount << ", %rsp\n";
             },
+            [&out](const ASMTree::DeallocateStack& ds) -> void {
+                out << "addq    $" << ds.amount << ", %rsp\n";
+            },
+            [&out](const ASMTree::Push& p) -> void {
+                out << "pushq    " << format(p.operand, 8) << "\n";
+            },
+            [&out](const ASMTree::Call& c) -> void {
+                out << "call    " << c.name << (c.external ? "@PLT" : "") << "\n";
+            },
+            [&out](const ASMTree::Cmp& c) -> void {
+                out << "cmpl    " << format(c.src) << ", " << format(c.dst) << "\n";
+            },
+            [&out](const ASMTree::Jmp& j) -> void {
+                out << "jmp    " << j.target << "\n";
+            },
+            [&out](const ASMTree::JmpCC& j) -> void {
+                out << "j" << suffix(j.cond) << "    " << j.target << "\n";
+            },
+            [&out](const ASMTree::SetCC& s) -> void {
+                out << "set" << suffix(s.cond) << "    " << format(s.dst, 1) << "\n";
+            },
+            [&out](const ASMTree::IncrementCounter& c) -> void {
+                out << "incq    .Lttc_profile_counters+" << c.counter * sizeof(uint64_t) << "(%rip)\n";
+            },
             [](const auto&) -> void { }
         }, instr);
     }
+}
+
+void Emitter::begin(const std::string& source, std::ostream& out, bool debug) {
+    if (debug) {
+        out << "    .file 1 " << quote(source) << "\n";
+    }
+}
+
+void Emitter::emit(const ASMTree::Function& f, std::ostream& out, bool debug) {
+    Location last;
+    ::emit(f, out, debug, last);
+}
+
+void Emitter::end(std::ostream& out) {
+    out << "    .section .note.GNU-stack,\"\",@progbits\n";
+}
+
+void Emitter::emit(const ASMTree::Program& node, std::ostream& out, bool debug) {
+    Location last;
+
+    begin(node.source, out, debug);
+
+    for (const auto& f : node.functions) {
+        ::emit(f, out, debug, last);
+    }
+
+    if (!node.counters.empty()) {
+        emit_profile_runtime(node, out);
+    }
+
+    end(out);
 }
\ No newline at end of file
@@ -6,7 +6,17 @@
 #include "asmtree.hpp"
 
 namespace Emitter {
-    void emit(const ASMTree::Program& node, std::ostream& out);
+    // With debug set, .file/.loc directives map each instruction back to
+    // its source line, from which the assembler builds the DWARF line table
+    void emit(const ASMTree::Program& node, std::ostream& out, bool debug);
+
+    // The pieces of emit, for output put together from functions emitted
+    // one at a time: what goes before the first function and after the last
+    void begin(const std::string& source, std::ostream& out, bool debug);
+
+    void emit(const ASMTree::Function& f, std::ostream& out, bool debug);
+
+    void end(std::ostream& out);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <ostream>
+#include "diagnostics.hpp"
+
+Diagnostic::Diagnostic(Diagnostic::Kind kind, Location loc, std::string message) :
+    kind(kind), loc(loc), message(std::move(message)) {}
+
+void Diagnostics::error(Diagnostic::Kind kind, Location loc, std::string message) {
+    if (!list.empty()) {
+        const Diagnostic& last = list.back();
+        if (last.kind == kind && last.loc.line == loc.line && last.loc.col == loc.col && last.message == message) {
+            return;
+        }
+    }
+
+    list.emplace_back(kind, loc, std::move(message));
+}
+
+size_t Diagnostics::size() const {
+    return list.size();
+}
+
+bool Diagnostics::empty() const {
+    return list.empty();
+}
+
+void Diagnostics::clear() {
+    list.clear();
+}
+
+std::string json_string(const std::string& s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void Diagnostics::print(std::ostream& out, Diagnostics::Format format, size_t limit) const {
+    size_t shown = limit == 0 ? list.size() : std::min(limit, list.size());
+
+    if (format == Diagnostics::Format::JSON) {
+        out << "{\"diagnostics\": [";
+        for (size_t idx = 0; idx < shown; ++idx) {
+            const Diagnostic& d = list[idx];
+            out << (idx ? ",\n" : "\n") << "  {\"kind\": \"" << (d.kind == Diagnostic::Kind::SYNTAX ? "syntax" : "semantic")
+                << "\", \"line\": " << d.loc.line << ", \"column\": " << d.loc.col
+                << ", \"message\": " << json_string(d.message) << "}";
+        }
+        out << (shown ? "\n" : "") << "], \"total\": " << list.size() << "}\n";
+        return;
+    }
+
+    for (size_t idx = 0; idx < shown; ++idx) {
+        const Diagnostic& d = list[idx];
+        out << (d.kind == Diagnostic::Kind::SYNTAX ? "Syntax error" : "Error") << " at line " << d.loc.line 
+            << ", column " << d.loc.col << ": " << d.message << "\n";
+    }
+    if (shown < list.size()) {
+        out << list.size() - shown << " more " << (list.size() - shown == 1 ? "error" : "errors") 
+            << " not shown; -ferror-limit=0 shows all\n";
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include "lexer.hpp"
+
+struct Diagnostic {
+    enum class Kind {
+        SYNTAX,
+        SEMANTIC,
+    };
+
+    Diagnostic::Kind kind;
+    Location loc;
+    std::string message;
+
+    Diagnostic(Diagnostic::Kind kind, Location loc, std::string message);
+};
+
+// Errors are collected as they are found and reported together once
+// compiling stops, so that one run reports all of them
+class Diagnostics {
+    std::vector<Diagnostic> list;
+
+public:
+    enum class Format {
+        TEXT,
+        JSON,
+    };
+
+    // An error repeating the one just before it, as the enclosing
+    // constructs of a truncated file each report, is dropped
+    void error(Diagnostic::Kind kind, Location loc, std::string message);
+
+    size_t size() const;
+
+    bool empty() const;
+
+    void clear();
+
+    // Prints the first limit errors, or all of them when limit is 0. JSON
+    // is a single object with the errors shown and how many there were.
+    void print(std::ostream& out, Diagnostics::Format format, size_t limit) const;
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+#include <functional>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "driver.hpp"
+
+// Unbuffered-by-the-stream, buffered-by-us writer for a raw file descriptor
+class FdBuf : public std::streambuf {
+    int fd;
+    char buf[1 << 14];
+    bool failed;
+
+    bool drain() {
+        char* p = pbase();
+        while (p < pptr()) {
+            ssize_t n = ::write(fd, p, pptr() - p);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                failed = true;
+                break;
+            }
+            p += n;
+        }
+        setp(buf, buf + sizeof(buf));
+        return !failed;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (!drain()) {
+            return traits_type::eof();
+        }
+        if (c != traits_type::eof()) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        return drain() ? 0 : -1;
+    }
+
+public:
+    FdBuf(int fd) : fd(fd), failed(false) {
+        setp(buf, buf + sizeof(buf));
+    }
+
+    bool ok() const {
+        return !failed;
+    }
+};
+
+pid_t spawn(const std::vector<std::string>& args, int stdin_fd) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    if (stdin_fd >= 0) {
+        dup2(stdin_fd, STDIN_FILENO);
+        close(stdin_fd);
+    }
+
+    std::vector<char*> argv;
+    for (const auto& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    execvp(argv[0], argv.data());
+    std::cerr << "Error: unable to run " << args[0] << ": " << std::strerror(errno) << "\n";
+    _exit(127);
+}
+
+bool wait_for(pid_t pid, const std::string& what) {
+    int status {};
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Error: " << what << " failed\n";
+        return false;
+    }
+    return true;
+}
+
+std::string fd_path(int fd) {
+    return "/dev/fd/" + std::to_string(fd);
+}
+
+bool assemble(const Driver::Writer& write, const std::string& object) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        std::cerr << "Error: unable to create pipe to the assembler\n";
+        return false;
+    }
+
+    // Keep our end of the pipe out of the assembler
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = spawn({ "as", "--64", "-o", object, "-" }, fds[0]);
+    close(fds[0]);
+
+    if (pid < 0) {
+        close(fds[1]);
+        std::cerr << "Error: unable to start the assembler\n";
+        return false;
+    }
+
+    bool written;
+    {
+        FdBuf buf(fds[1]);
+        std::ostream out(&buf);
+        write(out);
+        out.flush();
+        written = buf.ok();
+    }
+    close(fds[1]);
+
+    bool assembled = wait_for(pid, "assembler");
+    if (assembled && !written) {
+        std::cerr << "Error: unable to write to the assembler\n";
+    }
+    return assembled && written;
+}
+
+std::string Driver::default_output(const std::string& input, Driver::Mode mode) {
+    if (mode == Driver::Mode::EXECUTABLE) {
+        return "a.out";
+    }
+
+    std::string base = input.substr(input.find_last_of('/') + 1);
+    size_t dot = base.find_last_of('.');
+    if (dot != std::string::npos && dot != 0) {
+        base.erase(dot);
+    }
+
+    return base + (mode == Driver::Mode::ASSEMBLY ? ".s" : ".o");
+}
+
+bool Driver::build(const Driver::Writer& write, Driver::Mode mode, const std::string& output) {
+    if (mode == Driver::Mode::ASSEMBLY) {
+        std::ofstream output_file(output);
+
+        if (!output_file.is_open()) {
+            std::cerr << "Error: unable to open or create file '" << output << "'\n";
+            return false;
+        }
+
+        write(output_file);
+        return static_cast<bool>(output_file);
+    }
+
+    // A dead assembler should surface as a failed write, not kill us
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (mode == Driver::Mode::OBJECT) {
+        return assemble(write, output);
+    }
+
+    // The object only has to exist for as long as the linker runs; an
+    // anonymous memory file hands it over through /dev/fd without a name
+    // that parallel builds could fight over
+    int object_fd = memfd_create("ttc-object", 0);
+    if (object_fd < 0) {
+        std::cerr << "Error: unable to create in-memory object file\n";
+        return false;
+    }
+
+    std::string object = fd_path(object_fd);
+    bool ok = assemble(write, object);
+
+    if (ok) {
+        pid_t pid = spawn({ "cc", "-o", output, "-x", "none", object }, -1);
+        ok = pid >= 0 && wait_for(pid, "linker");
+    }
+
+    close(object_fd);
+    return ok;
+}
+
+std::optional<int> Driver::run(const Driver::Writer& write) {
+    int exe_fd = memfd_create("ttc-executable", 0);
+    if (exe_fd < 0) {
+        std::cerr << "Error: unable to create in-memory executable\n";
+        return std::nullopt;
+    }
+
+    if (!build(write, Driver::Mode::EXECUTABLE, fd_path(exe_fd))) {
+        close(exe_fd);
+        return std::nullopt;
+    }
+
+    // exec refuses files that are open for writing, so swap our
+    // read-write descriptor for a read-only one
+    int run_fd = open(("/proc/self/fd/" + std::to_string(exe_fd)).c_str(), O_RDONLY | O_CLOEXEC);
+    close(exe_fd);
+    if (run_fd < 0) {
+        std::cerr << "Error: unable to reopen in-memory executable\n";
+        return std::nullopt;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // A program that never finishes is killed with SIGXCPU instead
+        // of holding up the caller
+        struct rlimit limit = { RUN_CPU_SECONDS, RUN_CPU_SECONDS };
+        setrlimit(RLIMIT_CPU, &limit);
+        char name[] = "a.out";
+        char* argv[] = { name, nullptr };
+        fexecve(run_fd, argv, environ);
+        _exit(127);
+    }
+    close(run_fd);
+
+    if (pid < 0) {
+        return std::nullopt;
+    }
+
+    int status {};
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return std::nullopt;
+        }
+    }
+
+    if (!WIFEXITED(status)) {
+        return std::nullopt;
+    }
+    return WEXITSTATUS(status);
+}
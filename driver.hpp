@@ -0,0 +1,36 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <string>
+#include <ostream>
+#include <functional>
+#include <optional>
+
+// Runs the system assembler and linker on the emitted assembly. The
+// assembly is streamed into `as` over a pipe and, when linking, the object
+// lives in an anonymous in-memory file, so nothing but the requested output
+// is written to disk.
+namespace Driver {
+    enum class Mode {
+        ASSEMBLY,
+        OBJECT,
+        EXECUTABLE,
+    };
+
+    using Writer = std::function<void(std::ostream&)>;
+
+    // Output name used when -o is not given: a.out for executables, and the
+    // input's name with its extension replaced for .s and .o files
+    std::string default_output(const std::string& input, Mode mode);
+
+    bool build(const Writer& write, Mode mode, const std::string& output);
+
+    // Seconds of CPU time a program started by run may use
+    static constexpr unsigned RUN_CPU_SECONDS = 10;
+
+    // Links an executable in memory, runs it and returns its exit status,
+    // or nothing when it could not be run or did not exit by itself
+    std::optional<int> run(const Writer& write);
+}
+
+#endif
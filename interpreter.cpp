@@ -0,0 +1,203 @@
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include "tac.hpp"
+#include "lineartac.hpp"
+#include "interpreter.hpp"
+
+// Deep recursion is reported rather than overflowing the interpreter's stack
+static constexpr int MAX_DEPTH = 10000;
+// Jumps and branches taken before a program is given up on as never
+// finishing, which every loop has to take one of per iteration
+static constexpr uint64_t MAX_STEPS = 200'000'000;
+
+class Machine {
+    const LinearTAC::Program& p;
+    // The function each string id names, looked up once for every call
+    std::vector<const LinearTAC::Function*> by_name;
+    int depth;
+    uint64_t steps;
+
+    void step() {
+        if (++steps == MAX_STEPS) {
+            throw std::runtime_error("step limit reached, the program may not terminate");
+        }
+    }
+
+public:
+    Machine(const LinearTAC::Program& p) : p(p), by_name(p.strings.size()), depth(0), steps(0) {
+        for (const auto& f : p.functions) {
+            by_name[f.name] = &f;
+        }
+    }
+
+    const LinearTAC::Function& entry_point() const {
+        for (const auto& f : p.functions) {
+            if (p.strings[f.name] == "main") {
+                return f;
+            }
+        }
+        if (p.functions.empty()) {
+            throw std::runtime_error("no function to run");
+        }
+        return p.functions.front();
+    }
+
+    int32_t call(uint32_t name, const std::vector<int32_t>& args) {
+        const LinearTAC::Function* f = by_name[name];
+        if (!f) {
+            throw std::runtime_error("call to external function " + std::string(p.strings[name]));
+        }
+        if (depth == MAX_DEPTH) {
+            throw std::runtime_error("call stack exhausted in " + std::string(p.strings[name]));
+        }
+
+        ++depth;
+        int32_t result = run(*f, args);
+        --depth;
+        return result;
+    }
+
+    int32_t run(const LinearTAC::Function& f, const std::vector<int32_t>& args) {
+        // Every frame gets its own table, indexed by the function's slots
+        std::vector<int32_t> values(f.num_vars);
+        std::vector<int32_t> call_args;
+        size_t next_param {};
+        const LinearTAC::Instr* code = p.code.data();
+
+        // Offsets of the block being run and of the one run before it,
+        // which phis take their values from. What the phis assign waits
+        // until the last of the block's phis has read its value.
+        uint32_t block {};
+        uint32_t from = UINT32_MAX;
+        int32_t incoming {};
+        std::vector<std::pair<uint32_t, int32_t>> phis;
+
+        auto operand = [&values](const LinearTAC::Instr& i, int slot) -> int32_t {
+            return i.kinds[slot] == LinearTAC::OperandKind::VAR
+                ? values[i.operands[slot]]
+                : static_cast<int32_t>(i.operands[slot]);
+        };
+
+        // Arithmetic goes through uint32_t so it wraps the way the generated code does
+        uint32_t pc = f.first;
+        while (pc < f.first + f.count) {
+            const LinearTAC::Instr& i = code[pc++];
+            switch (i.op) {
+                case LinearTAC::Opcode::RETURN:
+                    return operand(i, 0);
+                case LinearTAC::Opcode::COMPLEMENT:
+                    values[i.operands[1]] = ~operand(i, 0);
+                    break;
+                case LinearTAC::Opcode::NEGATE:
+                    values[i.operands[1]] = static_cast<int32_t>(0u - static_cast<uint32_t>(operand(i, 0)));
+                    break;
+                case LinearTAC::Opcode::NOT:
+                    values[i.operands[1]] = operand(i, 0) == 0;
+                    break;
+                case LinearTAC::Opcode::ADD:
+                    values[i.operands[2]] = static_cast<int32_t>(
+                        static_cast<uint32_t>(operand(i, 0)) + static_cast<uint32_t>(operand(i, 1)));
+                    break;
+                case LinearTAC::Opcode::SUBTRACT:
+                    values[i.operands[2]] = static_cast<int32_t>(
+                        static_cast<uint32_t>(operand(i, 0)) - static_cast<uint32_t>(operand(i, 1)));
+                    break;
+                case LinearTAC::Opcode::MULTIPLY:
+                    values[i.operands[2]] = static_cast<int32_t>(
+                        static_cast<uint32_t>(operand(i, 0)) * static_cast<uint32_t>(operand(i, 1)));
+                    break;
+                case LinearTAC::Opcode::DIVIDE:
+                case LinearTAC::Opcode::REMAINDER: {
+                    int32_t lhs = operand(i, 0);
+                    int32_t rhs = operand(i, 1);
+                    // Both trap in the generated idivl
+                    if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+                        throw std::runtime_error("division overflow");
+                    }
+                    values[i.operands[2]] = i.op == LinearTAC::Opcode::DIVIDE ? lhs / rhs : lhs % rhs;
+                    break;
+                }
+                case LinearTAC::Opcode::EQUAL:
+                    values[i.operands[2]] = operand(i, 0) == operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::NOT_EQUAL:
+                    values[i.operands[2]] = operand(i, 0) != operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::LESS:
+                    values[i.operands[2]] = operand(i, 0) < operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::LESS_EQUAL:
+                    values[i.operands[2]] = operand(i, 0) <= operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::GREATER:
+                    values[i.operands[2]] = operand(i, 0) > operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::GREATER_EQUAL:
+                    values[i.operands[2]] = operand(i, 0) >= operand(i, 1);
+                    break;
+                case LinearTAC::Opcode::COPY:
+                    values[i.operands[1]] = operand(i, 0);
+                    break;
+                case LinearTAC::Opcode::PARAM:
+                    // Missing arguments read as 0, as main's parameters would
+                    values[i.operands[0]] = next_param < args.size() ? args[next_param] : 0;
+                    ++next_param;
+                    block = pc - f.first;
+                    break;
+                case LinearTAC::Opcode::ARG:
+                    call_args.push_back(operand(i, 0));
+                    break;
+                case LinearTAC::Opcode::CALL:
+                    values[i.operands[1]] = call(i.operands[0], call_args);
+                    call_args.clear();
+                    break;
+                case LinearTAC::Opcode::JUMP:
+                    step();
+                    from = block;
+                    block = i.operands[0];
+                    pc = f.first + block;
+                    break;
+                case LinearTAC::Opcode::BRANCH:
+                    step();
+                    from = block;
+                    block = operand(i, 0) != 0 ? i.operands[1] : i.operands[2];
+                    pc = f.first + block;
+                    break;
+                case LinearTAC::Opcode::INCOMING:
+                    if (i.operands[1] == from) {
+                        incoming = operand(i, 0);
+                    }
+                    break;
+                case LinearTAC::Opcode::PHI:
+                    phis.emplace_back(i.operands[1], incoming);
+                    incoming = 0;
+                    // A block never ends in a phi, so there is always a next
+                    // instruction to look at
+                    if (code[pc].op != LinearTAC::Opcode::INCOMING && code[pc].op != LinearTAC::Opcode::PHI) {
+                        for (const auto& [var, val] : phis) {
+                            values[var] = val;
+                        }
+                        phis.clear();
+                    }
+                    break;
+                case LinearTAC::Opcode::NOP:
+                    break;
+            }
+        }
+
+        // Falling off the end of a function returns 0
+        return 0;
+    }
+};
+
+int Interpreter::run(const LinearTAC::Program& p) {
+    Machine m = Machine(p);
+    return m.run(m.entry_point(), {});
+}
+
+int Interpreter::run(const TAC::Program& p) {
+    return run(LinearTAC::encode(p));
+}
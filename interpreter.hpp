@@ -0,0 +1,19 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "tac.hpp"
+#include "lineartac.hpp"
+
+// Reference semantics for the TAC. Programs are run from their linear
+// encoding, whose variable slots index straight into a flat table sized
+// for each function.
+namespace Interpreter {
+    // Returns the value main returns. Throws std::runtime_error for calls
+    // to functions the program does not define, which only the native
+    // code can make, and for programs that run too long to finish
+    int run(const LinearTAC::Program& p);
+
+    int run(const TAC::Program& p);
+}
+
+#endif
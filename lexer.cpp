@@ -5,11 +5,15 @@
 #include <string_view>
 #include "lexer.hpp"
 
-Token::Token(TokenType type, std::string lexeme, int line, int col) : 
-    type(type), lexeme(std::move(lexeme)), line(line), col(col) {}
+Token::Token(TokenType type, std::string lexeme, int line, int col, int offset) : 
+    type(type), lexeme(std::move(lexeme)), line(line), col(col), offset(offset) {}
+
+Location Token::loc() const {
+    return Location{line, col};
+}
 
 void Lexer::add_token(TokenType token, std::string_view lexeme, int line, int col) {
-    tokens.emplace_back(token, std::string(lexeme), line, col);
+    tokens.emplace_back(token, std::string(lexeme), line, col, static_cast<int>(start));
 }
 
 void Lexer::add_next_token(const std::string_view input) {
@@ -48,9 +52,74 @@ void Lexer::add_next_token(const std::string_view input) {
         case ';':
             add_token(TokenType::TOKEN_SEMI, ";", line, col);
             break;
+        case ',':
+            add_token(TokenType::TOKEN_COMMA, ",", line, col);
+            break;
+        case '=':
+            if (curr + 1 < input.length() && input[curr + 1] == '=') {
+                add_token(TokenType::TOKEN_EQUAL, "==", line, col);
+                ++curr;
+                ++col;
+            } else {
+                add_token(TokenType::TOKEN_ASSIGN, "=", line, col);
+            }
+            break;
+        case '!':
+            if (curr + 1 < input.length() && input[curr + 1] == '=') {
+                add_token(TokenType::TOKEN_NOT_EQUAL, "!=", line, col);
+                ++curr;
+                ++col;
+            } else {
+                add_token(TokenType::TOKEN_NOT, "!", line, col);
+            }
+            break;
+        case '<':
+            if (curr + 1 < input.length() && input[curr + 1] == '=') {
+                add_token(TokenType::TOKEN_LESS_EQUAL, "<=", line, col);
+                ++curr;
+                ++col;
+            } else {
+                add_token(TokenType::TOKEN_LESS, "<", line, col);
+            }
+            break;
+        case '>':
+            if (curr + 1 < input.length() && input[curr + 1] == '=') {
+                add_token(TokenType::TOKEN_GREATER_EQUAL, ">=", line, col);
+                ++curr;
+                ++col;
+            } else {
+                add_token(TokenType::TOKEN_GREATER, ">", line, col);
+            }
+            break;
+        case '+':
+            add_token(TokenType::TOKEN_PLUS, "+", line, col);
+            break;
+        case '*':
+            add_token(TokenType::TOKEN_STAR, "*", line, col);
+            break;
+        case '/':
+            add_token(TokenType::TOKEN_SLASH, "/", line, col);
+            break;
+        case '%':
+            add_token(TokenType::TOKEN_PERCENT, "%", line, col);
+            break;
         case '~':
             add_token(TokenType::TOKEN_TILDE, "~", line, col);
             break;
+        case '&':
+            if (curr + 1 < input.length() && input[curr + 1] == '&') {
+                add_token(TokenType::TOKEN_AND, "&&", line, col);
+                ++curr;
+                ++col;
+            }
+            break;
+        case '|':
+            if (curr + 1 < input.length() && input[curr + 1] == '|') {
+                add_token(TokenType::TOKEN_OR, "||", line, col);
+                ++curr;
+                ++col;
+            }
+            break;
         case '-':
             if (curr + 1 < input.length() && input[curr + 1] == '-') {
                 add_token(TokenType::TOKEN_DEC, "--", line, col);
@@ -98,21 +167,18 @@ void Lexer::add_next_token(const std::string_view input) {
     ++curr;
 }
 
-Lexer::Lexer() : curr(0), start(0), line(0), col(0) {}
-
-const std::vector<Token>& Lexer::get_tokens() {
-    return tokens;
-}
+Lexer::Lexer() : start(0), curr(0), line(0), col(0) {}
 
-const std::vector<Token>& Lexer::read(std::string_view input) {
+std::vector<Token> Lexer::read(std::string_view input) {
     while (curr < input.length()) {
         start = curr;
         add_next_token(input);
     }
 
-    if (tokens.back().type != TokenType::TOKEN_EOF) {
+    if (tokens.empty() || tokens.back().type != TokenType::TOKEN_EOF) {
+        start = curr;
         add_token(TokenType::TOKEN_EOF, "", line, col);
     }
 
-    return tokens;
+    return std::move(tokens);
 }
\ No newline at end of file
@@ -15,6 +15,9 @@ enum class TokenType {
     TOKEN_INT,
     TOKEN_VOID,
     TOKEN_RET,
+    TOKEN_IF,
+    TOKEN_ELSE,
+    TOKEN_WHILE,
 
 
     // Parans and braces
@@ -23,28 +26,54 @@ enum class TokenType {
     TOKEN_OPEN_BRACE,
     TOKEN_CLOSED_BRACE,
     TOKEN_SEMI,
+    TOKEN_COMMA,
+    TOKEN_ASSIGN,
 
     // Unary operators
     TOKEN_TILDE,
     TOKEN_NEG,
     TOKEN_DEC,
 
+    // Binary operators
+    TOKEN_PLUS,
+    TOKEN_STAR,
+    TOKEN_SLASH,
+    TOKEN_PERCENT,
+    TOKEN_LESS,
+    TOKEN_LESS_EQUAL,
+    TOKEN_GREATER,
+    TOKEN_GREATER_EQUAL,
+    TOKEN_EQUAL,
+    TOKEN_NOT_EQUAL,
+    TOKEN_NOT,
+    TOKEN_AND,
+    TOKEN_OR,
+
     TOKEN_EOF,
 };
 
+struct Location {
+    int line = -1;
+    int col = -1;
+};
+
 struct Token {
     TokenType type;
     std::string lexeme;
     int line;
     int col;
+    // Byte offset of the token's first character in the input
+    int offset;
+
+    Token(TokenType type, std::string lexeme, int line, int col, int offset);
 
-    Token(TokenType type, std::string lexeme, int line, int col);
+    Location loc() const;
 };
 
 class Lexer {
     private:
-        int start;
-        int curr;
+        size_t start;
+        size_t curr;
         int line;
         int col;
 
@@ -52,7 +81,10 @@ class Lexer {
         static inline const std::unordered_map<std::string, TokenType> keywords = {
             {"int", TokenType::TOKEN_INT},
             {"void", TokenType::TOKEN_VOID},
-            {"return", TokenType::TOKEN_RET}
+            {"return", TokenType::TOKEN_RET},
+            {"if", TokenType::TOKEN_IF},
+            {"else", TokenType::TOKEN_ELSE},
+            {"while", TokenType::TOKEN_WHILE}
         };
 
         void add_token(TokenType token, std::string_view lexeme, int line, int col);
@@ -60,8 +92,8 @@ class Lexer {
 
     public:
         Lexer();
-        const std::vector<Token>& get_tokens();
-        const std::vector<Token>& read(std::string_view input);
+        // Hands the lexed tokens over to the caller; the lexer keeps no copy
+        std::vector<Token> read(std::string_view input);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,635 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <variant>
+#include <optional>
+#include <fstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tac.hpp"
+#include "lineartac.hpp"
+
+// On-disk layout, all fields in host byte order:
+//   Header
+//   Function[num_functions]
+//   Instr[num_instrs]
+//   Location[num_instrs]
+//   uint32_t vars[num_vars]
+//   uint32_t string_offsets[num_strings + 1]
+//   char string_data[string_bytes]
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_functions;
+    uint32_t num_instrs;
+    uint32_t num_vars;
+    uint32_t num_strings;
+    uint32_t string_bytes;
+    uint32_t source;
+};
+
+static constexpr char MAGIC[4] = { 'T', 'T', 'A', 'C' };
+
+// What the encoder fills in, and what the records of an encoded program
+// point into
+struct Buffers {
+    std::vector<LinearTAC::Function> functions;
+    std::vector<LinearTAC::Instr> code;
+    std::vector<Location> locs;
+    std::vector<uint32_t> vars;
+    std::vector<std::string> strings;
+};
+
+// Unmaps a file read back once no program refers to it any more
+struct Mapping {
+    void* addr;
+    size_t size;
+
+    Mapping(void* addr, size_t size) : addr(addr), size(size) {}
+
+    ~Mapping() {
+        munmap(addr, size);
+    }
+};
+
+template<class... Ts> struct overloaded : Ts... {
+    using Ts::operator()...;
+};
+
+template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+LinearTAC::Opcode unary_opcode(TAC::Unary::UnOp op) {
+    switch (op) {
+        case TAC::Unary::UnOp::COMPLEMENT:
+            return LinearTAC::Opcode::COMPLEMENT;
+        case TAC::Unary::UnOp::NEGATE:
+            return LinearTAC::Opcode::NEGATE;
+        default:
+            return LinearTAC::Opcode::NOT;
+    }
+}
+
+LinearTAC::Opcode binary_opcode(TAC::Binary::BinOp op) {
+    return static_cast<LinearTAC::Opcode>(static_cast<uint8_t>(LinearTAC::Opcode::ADD) + static_cast<uint8_t>(op));
+}
+
+bool is_binary(LinearTAC::Opcode op) {
+    return op >= LinearTAC::Opcode::ADD && op <= LinearTAC::Opcode::GREATER_EQUAL;
+}
+
+class Encoder {
+    Buffers& out;
+    std::unordered_map<std::string, uint32_t> ids;
+    // Slots of the variables of the function being encoded
+    std::unordered_map<std::string, uint32_t> slots;
+    // Jump and branch targets, and the blocks phis take values from, are
+    // block numbers until the function is done and the offset of every
+    // block is known
+    std::vector<size_t> targets;
+
+public:
+    Encoder(Buffers& out) : out(out) {}
+
+    uint32_t intern(const std::string& s) {
+        auto [it, inserted] = ids.try_emplace(s, static_cast<uint32_t>(out.strings.size()));
+        if (inserted) {
+            out.strings.push_back(s);
+        }
+        return it->second;
+    }
+
+    uint32_t slot(const std::string& var) {
+        auto [it, inserted] = slots.try_emplace(var, static_cast<uint32_t>(slots.size()));
+        if (inserted) {
+            out.vars.push_back(intern(var));
+        }
+        return it->second;
+    }
+
+    void encode(const TAC::Val& v, LinearTAC::Instr& instr, int slot) {
+        std::visit(
+            overloaded {
+                [&](const TAC::Constant& c) -> void {
+                    instr.kinds[slot] = LinearTAC::OperandKind::CONSTANT;
+                    instr.operands[slot] = static_cast<uint32_t>(c.val);
+                },
+                [&](const TAC::Var& w) -> void {
+                    instr.kinds[slot] = LinearTAC::OperandKind::VAR;
+                    instr.operands[slot] = this->slot(w.identifier);
+                },
+                [](std::monostate) -> void {}
+            }, v
+        );
+    }
+
+    void encode(const TAC::Instr& i) {
+        LinearTAC::Instr instr {};
+        Location loc;
+
+        std::visit(
+            overloaded {
+                [&](const TAC::Return& r) -> void {
+                    instr.op = LinearTAC::Opcode::RETURN;
+                    encode(r.val, instr, 0);
+                    loc = r.loc;
+                },
+                [&](const TAC::Unary& u) -> void {
+                    instr.op = unary_opcode(u.op);
+                    encode(u.src, instr, 0);
+                    encode(u.dst, instr, 1);
+                    loc = u.loc;
+                },
+                [&](const TAC::Binary& b) -> void {
+                    instr.op = binary_opcode(b.op);
+                    encode(b.src1, instr, 0);
+                    encode(b.src2, instr, 1);
+                    encode(b.dst, instr, 2);
+                    loc = b.loc;
+                },
+                [&](const TAC::Copy& c) -> void {
+                    instr.op = LinearTAC::Opcode::COPY;
+                    encode(c.src, instr, 0);
+                    encode(c.dst, instr, 1);
+                    loc = c.loc;
+                },
+                [&](const TAC::FunCall& c) -> void {
+                    for (const auto& arg : c.args) {
+                        LinearTAC::Instr arg_instr {};
+                        arg_instr.op = LinearTAC::Opcode::ARG;
+                        encode(arg, arg_instr, 0);
+                        out.code.push_back(arg_instr);
+                        out.locs.push_back(c.loc);
+                    }
+
+                    instr.op = LinearTAC::Opcode::CALL;
+                    instr.operands[0] = intern(c.name);
+                    encode(c.dst, instr, 1);
+                    instr.operands[2] = static_cast<uint32_t>(c.args.size());
+                    loc = c.loc;
+                },
+                [&](const TAC::Jump& j) -> void {
+                    instr.op = LinearTAC::Opcode::JUMP;
+                    instr.operands[0] = static_cast<uint32_t>(j.target);
+                    targets.push_back(out.code.size());
+                    loc = j.loc;
+                },
+                [&](const TAC::Branch& br) -> void {
+                    instr.op = LinearTAC::Opcode::BRANCH;
+                    encode(br.cond, instr, 0);
+                    instr.operands[1] = static_cast<uint32_t>(br.if_true);
+                    instr.operands[2] = static_cast<uint32_t>(br.if_false);
+                    targets.push_back(out.code.size());
+                    loc = br.loc;
+                },
+                [&](const TAC::Phi& phi) -> void {
+                    for (const auto& [pred, val] : phi.incoming) {
+                        LinearTAC::Instr in {};
+                        in.op = LinearTAC::Opcode::INCOMING;
+                        encode(val, in, 0);
+                        in.operands[1] = static_cast<uint32_t>(pred);
+                        targets.push_back(out.code.size());
+                        out.code.push_back(in);
+                        out.locs.push_back(phi.loc);
+                    }
+
+                    instr.op = LinearTAC::Opcode::PHI;
+                    encode(phi.dst, instr, 1);
+                    instr.operands[2] = static_cast<uint32_t>(phi.incoming.size());
+                    loc = phi.loc;
+                },
+                [](std::monostate) -> void {}
+            }, i
+        );
+
+        out.code.push_back(instr);
+        out.locs.push_back(loc);
+    }
+
+    void encode(const TAC::Function& f) {
+        LinearTAC::Function lf {};
+        lf.name = intern(f.identifier);
+        lf.first = static_cast<uint32_t>(out.code.size());
+        lf.first_var = static_cast<uint32_t>(out.vars.size());
+        lf.loc = f.loc;
+        slots.clear();
+
+        for (const auto& param : f.params) {
+            LinearTAC::Instr instr {};
+            instr.op = LinearTAC::Opcode::PARAM;
+            encode(TAC::Var(param), instr, 0);
+            out.code.push_back(instr);
+            out.locs.push_back(f.loc);
+        }
+
+        std::vector<uint32_t> offsets;
+        offsets.reserve(f.blocks.size());
+        targets.clear();
+        for (const auto& b : f.blocks) {
+            offsets.push_back(static_cast<uint32_t>(out.code.size()) - lf.first);
+            for (const auto& i : b.instructions) {
+                encode(i);
+            }
+        }
+
+        for (size_t idx : targets) {
+            LinearTAC::Instr& instr = out.code[idx];
+            if (instr.op == LinearTAC::Opcode::JUMP) {
+                instr.operands[0] = offsets[instr.operands[0]];
+            } else if (instr.op == LinearTAC::Opcode::INCOMING) {
+                instr.operands[1] = offsets[instr.operands[1]];
+            } else {
+                instr.operands[1] = offsets[instr.operands[1]];
+                instr.operands[2] = offsets[instr.operands[2]];
+            }
+        }
+
+        lf.count = static_cast<uint32_t>(out.code.size()) - lf.first;
+        lf.num_vars = static_cast<uint32_t>(slots.size());
+        out.functions.push_back(lf);
+    }
+};
+
+LinearTAC::Program LinearTAC::encode(const TAC::Program& p) {
+    auto buffers = std::make_shared<Buffers>();
+    buffers->functions.reserve(p.functions.size());
+
+    Encoder encoder(*buffers);
+    for (const auto& f : p.functions) {
+        encoder.encode(f);
+    }
+
+    LinearTAC::Program out;
+    if (!p.source.empty()) {
+        out.source = encoder.intern(p.source);
+    }
+
+    // The buffers are done growing, so the records can point into them
+    out.functions = { buffers->functions.data(), buffers->functions.size() };
+    out.code = { buffers->code.data(), buffers->code.size() };
+    out.locs = { buffers->locs.data(), buffers->locs.size() };
+    out.vars = { buffers->vars.data(), buffers->vars.size() };
+    out.strings.reserve(buffers->strings.size());
+    for (const auto& str : buffers->strings) {
+        out.strings.emplace_back(str);
+    }
+    out.storage = std::move(buffers);
+    return out;
+}
+
+TAC::Var decode_var(const LinearTAC::Program& p, const LinearTAC::Function& lf, 
+        const LinearTAC::Instr& instr, int slot) {
+    return TAC::Var(std::string(p.strings[p.vars[lf.first_var + instr.operands[slot]]]));
+}
+
+TAC::Val decode_val(const LinearTAC::Program& p, const LinearTAC::Function& lf, 
+        const LinearTAC::Instr& instr, int slot) {
+    switch (instr.kinds[slot]) {
+        case LinearTAC::OperandKind::CONSTANT:
+            return TAC::Constant(static_cast<int>(instr.operands[slot]));
+        case LinearTAC::OperandKind::VAR:
+            return decode_var(p, lf, instr, slot);
+        default:
+            return std::monostate{};
+    }
+}
+
+bool is_terminator(LinearTAC::Opcode op) {
+    return op == LinearTAC::Opcode::RETURN || op == LinearTAC::Opcode::JUMP || op == LinearTAC::Opcode::BRANCH;
+}
+
+// A new block starts at the first instruction past the PARAMs and after
+// every terminator; maps each of those offsets to its block number
+std::unordered_map<uint32_t, size_t> block_offsets(const LinearTAC::Program& p, const LinearTAC::Function& lf) {
+    std::unordered_map<uint32_t, size_t> blocks;
+    bool starts_block = true;
+    for (uint32_t offset = 0; offset < lf.count; ++offset) {
+        const LinearTAC::Instr& instr = p.code[lf.first + offset];
+        if (instr.op == LinearTAC::Opcode::PARAM) {
+            continue;
+        }
+        if (starts_block) {
+            blocks.emplace(offset, blocks.size());
+        }
+        starts_block = is_terminator(instr.op);
+    }
+    return blocks;
+}
+
+TAC::Function decode_function(const LinearTAC::Program& p, const LinearTAC::Function& lf) {
+    TAC::Function f = TAC::Function(std::string(p.strings[lf.name]), {}, lf.loc);
+    std::unordered_map<uint32_t, size_t> blocks = block_offsets(p, lf);
+    f.blocks.resize(blocks.size());
+    std::vector<TAC::Val> args;
+    std::vector<std::pair<size_t, TAC::Val>> incoming;
+    size_t current {};
+
+    for (uint32_t idx = lf.first; idx < lf.first + lf.count; ++idx) {
+        const LinearTAC::Instr& instr = p.code[idx];
+        const Location& loc = p.locs[idx];
+        std::vector<TAC::Instr>& out = f.blocks[current].instructions;
+        switch (instr.op) {
+            case LinearTAC::Opcode::RETURN:
+                out.emplace_back(std::in_place_type<TAC::Return>, decode_val(p, lf, instr, 0), loc);
+                break;
+            case LinearTAC::Opcode::COMPLEMENT:
+            case LinearTAC::Opcode::NEGATE:
+            case LinearTAC::Opcode::NOT: {
+                TAC::Unary::UnOp op = instr.op == LinearTAC::Opcode::COMPLEMENT ? TAC::Unary::UnOp::COMPLEMENT
+                    : instr.op == LinearTAC::Opcode::NEGATE ? TAC::Unary::UnOp::NEGATE
+                    : TAC::Unary::UnOp::NOT;
+                out.emplace_back(std::in_place_type<TAC::Unary>, op,
+                    decode_val(p, lf, instr, 0), decode_var(p, lf, instr, 1), loc);
+                break;
+            }
+            case LinearTAC::Opcode::COPY:
+                out.emplace_back(std::in_place_type<TAC::Copy>,
+                    decode_val(p, lf, instr, 0), decode_var(p, lf, instr, 1), loc);
+                break;
+            case LinearTAC::Opcode::PARAM:
+                f.params.push_back(decode_var(p, lf, instr, 0).identifier);
+                break;
+            case LinearTAC::Opcode::ARG:
+                args.push_back(decode_val(p, lf, instr, 0));
+                break;
+            case LinearTAC::Opcode::CALL:
+                out.emplace_back(std::in_place_type<TAC::FunCall>, std::string(p.strings[instr.operands[0]]),
+                    std::move(args), decode_var(p, lf, instr, 1), loc);
+                args.clear();
+                break;
+            case LinearTAC::Opcode::JUMP:
+                out.emplace_back(std::in_place_type<TAC::Jump>, blocks.at(instr.operands[0]), loc);
+                break;
+            case LinearTAC::Opcode::BRANCH:
+                out.emplace_back(std::in_place_type<TAC::Branch>, decode_val(p, lf, instr, 0),
+                    blocks.at(instr.operands[1]), blocks.at(instr.operands[2]), loc);
+                break;
+            case LinearTAC::Opcode::INCOMING:
+                incoming.emplace_back(blocks.at(instr.operands[1]), decode_val(p, lf, instr, 0));
+                break;
+            case LinearTAC::Opcode::PHI:
+                out.emplace_back(std::in_place_type<TAC::Phi>, std::move(incoming), decode_var(p, lf, instr, 1), loc);
+                incoming.clear();
+                break;
+            case LinearTAC::Opcode::NOP:
+                break;
+            default: {
+                auto op = static_cast<TAC::Binary::BinOp>(static_cast<uint8_t>(instr.op) - 
+                    static_cast<uint8_t>(LinearTAC::Opcode::ADD));
+                out.emplace_back(std::in_place_type<TAC::Binary>, op, 
+                    decode_val(p, lf, instr, 0), decode_val(p, lf, instr, 1), decode_var(p, lf, instr, 2), loc);
+                break;
+            }
+        }
+
+        if (is_terminator(instr.op)) {
+            ++current;
+        }
+    }
+
+    return f;
+}
+
+TAC::Program LinearTAC::decode(const LinearTAC::Program& p) {
+    std::vector<TAC::Function> functions;
+    functions.reserve(p.functions.size());
+    for (const auto& lf : p.functions) {
+        functions.push_back(decode_function(p, lf));
+    }
+
+    TAC::Program tac = TAC::Program(std::move(functions));
+    if (p.source != LinearTAC::NO_STRING) {
+        tac.source = p.strings[p.source];
+    }
+    return tac;
+}
+
+bool LinearTAC::write(const LinearTAC::Program& p, const std::string& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(p.strings.size() + 1);
+    uint32_t total {};
+    for (const auto& s : p.strings) {
+        offsets.push_back(total);
+        total += static_cast<uint32_t>(s.size());
+    }
+    offsets.push_back(total);
+
+    Header h {};
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.num_functions = static_cast<uint32_t>(p.functions.size());
+    h.num_instrs = static_cast<uint32_t>(p.code.size());
+    h.num_vars = static_cast<uint32_t>(p.vars.size());
+    h.num_strings = static_cast<uint32_t>(p.strings.size());
+    h.string_bytes = total;
+    h.source = p.source;
+
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(p.functions.data()), p.functions.size() * sizeof(LinearTAC::Function));
+    out.write(reinterpret_cast<const char*>(p.code.data()), p.code.size() * sizeof(LinearTAC::Instr));
+    out.write(reinterpret_cast<const char*>(p.locs.data()), p.locs.size() * sizeof(Location));
+    out.write(reinterpret_cast<const char*>(p.vars.data()), p.vars.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+    for (const auto& s : p.strings) {
+        out.write(s.data(), s.size());
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool valid_operand(const LinearTAC::Function& f, const LinearTAC::Instr& instr, int slot) {
+    switch (instr.kinds[slot]) {
+        case LinearTAC::OperandKind::NONE:
+        case LinearTAC::OperandKind::CONSTANT:
+            return true;
+        case LinearTAC::OperandKind::VAR:
+            return instr.operands[slot] < f.num_vars;
+        default:
+            return false;
+    }
+}
+
+bool validate(const LinearTAC::Program& p) {
+    if (p.functions.empty() || (p.source != LinearTAC::NO_STRING && p.source >= p.strings.size())) {
+        return false;
+    }
+
+    for (const auto& f : p.functions) {
+        if (f.name >= p.strings.size() || f.first > p.code.size() || f.count > p.code.size() - f.first ||
+                f.first_var > p.vars.size() || f.num_vars > p.vars.size() - f.first_var) {
+            return false;
+        }
+        for (uint32_t idx = f.first_var; idx < f.first_var + f.num_vars; ++idx) {
+            if (p.vars[idx] >= p.strings.size()) {
+                return false;
+            }
+        }
+
+        // Checked per function so that decoding can trust every CALL to
+        // find its ARGs, every PHI its INCOMINGs, every PARAM to sit at the
+        // top of its function and every PHI at the top of its block, and
+        // every jump to land at the start of a block
+        bool in_params = true;
+        bool in_phis = true;
+        uint32_t pending_args {};
+        uint32_t pending_incoming {};
+        std::unordered_map<uint32_t, size_t> blocks = block_offsets(p, f);
+        auto is_block = [&blocks](uint32_t offset) -> bool {
+            return blocks.count(offset) > 0;
+        };
+
+        for (uint32_t idx = f.first; idx < f.first + f.count; ++idx) {
+            const LinearTAC::Instr& instr = p.code[idx];
+            if (instr.op > LinearTAC::Opcode::PHI) {
+                return false;
+            }
+
+            // CALL, JUMP and BRANCH keep raw ids and offsets in some slots
+            bool raw = instr.op == LinearTAC::Opcode::CALL || instr.op == LinearTAC::Opcode::JUMP;
+            for (int slot = 0; slot < 3; ++slot) {
+                if (!raw && !(instr.op == LinearTAC::Opcode::BRANCH && slot > 0) && !valid_operand(f, instr, slot)) {
+                    return false;
+                }
+            }
+
+            if (instr.op == LinearTAC::Opcode::PARAM) {
+                if (!in_params || instr.kinds[0] != LinearTAC::OperandKind::VAR) {
+                    return false;
+                }
+                continue;
+            }
+            in_params = false;
+
+            if (instr.op == LinearTAC::Opcode::INCOMING) {
+                if (!in_phis || !is_block(instr.operands[1])) {
+                    return false;
+                }
+                ++pending_incoming;
+                continue;
+            }
+            if (instr.op == LinearTAC::Opcode::PHI) {
+                if (!in_phis || instr.operands[2] != pending_incoming || instr.kinds[1] != LinearTAC::OperandKind::VAR) {
+                    return false;
+                }
+                pending_incoming = 0;
+                continue;
+            }
+            if (pending_incoming) {
+                return false;
+            }
+            in_phis = is_terminator(instr.op);
+
+            if (instr.op == LinearTAC::Opcode::ARG) {
+                ++pending_args;
+                continue;
+            }
+
+            if (instr.op == LinearTAC::Opcode::CALL && (instr.operands[0] >= p.strings.size() ||
+                    instr.operands[2] != pending_args || !valid_operand(f, instr, 1))) {
+                return false;
+            }
+            if (instr.op != LinearTAC::Opcode::CALL && pending_args) {
+                return false;
+            }
+            pending_args = 0;
+
+            if (instr.op == LinearTAC::Opcode::JUMP && !is_block(instr.operands[0])) {
+                return false;
+            }
+            if (instr.op == LinearTAC::Opcode::BRANCH && (!is_block(instr.operands[1]) || !is_block(instr.operands[2]))) {
+                return false;
+            }
+
+            bool has_dst = instr.op == LinearTAC::Opcode::COMPLEMENT || instr.op == LinearTAC::Opcode::NEGATE ||
+                instr.op == LinearTAC::Opcode::NOT ||
+                instr.op == LinearTAC::Opcode::COPY || instr.op == LinearTAC::Opcode::CALL;
+            if (has_dst && instr.kinds[1] != LinearTAC::OperandKind::VAR) {
+                return false;
+            }
+            if (is_binary(instr.op) && instr.kinds[2] != LinearTAC::OperandKind::VAR) {
+                return false;
+            }
+        }
+
+        // Every block, the last included, has to end in a terminator
+        if (pending_args || blocks.empty() || !is_terminator(p.code[f.first + f.count - 1].op)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::optional<LinearTAC::Program> LinearTAC::read(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return std::nullopt;
+    }
+
+    auto mapped = std::make_shared<Mapping>(mapping, size);
+    const char* base = static_cast<const char*>(mapping);
+    Header h;
+    std::memcpy(&h, base, sizeof(h));
+
+    // Sizes are computed in 64 bits so a corrupt header cannot wrap around
+    uint64_t functions_at = sizeof(Header);
+    uint64_t code_at = functions_at + uint64_t(h.num_functions) * sizeof(LinearTAC::Function);
+    uint64_t locs_at = code_at + uint64_t(h.num_instrs) * sizeof(LinearTAC::Instr);
+    uint64_t vars_at = locs_at + uint64_t(h.num_instrs) * sizeof(Location);
+    uint64_t offsets_at = vars_at + uint64_t(h.num_vars) * sizeof(uint32_t);
+    uint64_t strings_at = offsets_at + (uint64_t(h.num_strings) + 1) * sizeof(uint32_t);
+    uint64_t end = strings_at + h.string_bytes;
+
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION || end != size) {
+        return std::nullopt;
+    }
+
+    // Every section is a multiple of 4 bytes long and the mapping starts on
+    // a page, so the records are aligned where they lie
+    LinearTAC::Program p;
+    p.functions = { reinterpret_cast<const LinearTAC::Function*>(base + functions_at), h.num_functions };
+    p.code = { reinterpret_cast<const LinearTAC::Instr*>(base + code_at), h.num_instrs };
+    p.locs = { reinterpret_cast<const Location*>(base + locs_at), h.num_instrs };
+    p.vars = { reinterpret_cast<const uint32_t*>(base + vars_at), h.num_vars };
+    p.source = h.source;
+
+    const auto* offsets = reinterpret_cast<const uint32_t*>(base + offsets_at);
+    bool ok = offsets[h.num_strings] == h.string_bytes;
+    p.strings.reserve(h.num_strings);
+    for (uint32_t idx = 0; ok && idx < h.num_strings; ++idx) {
+        if (offsets[idx] > offsets[idx + 1]) {
+            ok = false;
+            break;
+        }
+        p.strings.emplace_back(base + strings_at + offsets[idx], offsets[idx + 1] - offsets[idx]);
+    }
+    p.storage = std::move(mapped);
+
+    if (!ok || !validate(p)) {
+        return std::nullopt;
+    }
+
+    return p;
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#ifndef LINEARTAC_H
+#define LINEARTAC_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include "tac.hpp"
+
+// Dense, fixed-width encoding of the TAC. Every instruction is 16 bytes and
+// refers to variables by a 32-bit slot in its function's frame, so a whole
+// program lives in a few contiguous buffers and can be written to disk and
+// mapped back in without re-parsing. A program read back from disk points
+// straight into the mapped file, and the interpreter and the decoder walk
+// its records where they lie.
+namespace LinearTAC {
+    static constexpr uint32_t VERSION = 8;
+    static constexpr uint32_t NO_STRING = UINT32_MAX;
+
+    enum class Opcode : uint8_t {
+        NOP,
+        RETURN,
+        COMPLEMENT,
+        NEGATE,
+        COPY,
+        // Binds the next argument to operand 0; a function's PARAMs come
+        // before any of its other instructions
+        PARAM,
+        // Pushes operand 0 as the next argument of the following CALL
+        ARG,
+        // Calls the function named by string id operands[0] with the
+        // operands[2] ARGs before it, storing the result in operand 1
+        CALL,
+        // Blocks are laid out one after another, each ending at its only
+        // jump, branch or return; targets are the offsets of the blocks'
+        // first instructions from the function's first
+        JUMP,
+        // Goes to operands[1] when operand 0 is nonzero and to operands[2]
+        // otherwise
+        BRANCH,
+        NOT,
+        // Binary operators, in the order of TAC::Binary::BinOp, compute
+        // operands 0 and 1 into operand 2
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        REMAINDER,
+        EQUAL,
+        NOT_EQUAL,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        // Operand 0 is the value the following PHI takes when control came
+        // from the block at offset operands[1]
+        INCOMING,
+        // Stores in operand 1 the value of whichever of the operands[2]
+        // INCOMINGs before it matches the block control came from. PHIs
+        // open their block, and all of a block's read before any assigns.
+        PHI,
+    };
+
+    enum class OperandKind : uint8_t {
+        NONE,
+        CONSTANT,
+        VAR,
+    };
+
+    struct Instr {
+        Opcode op;
+        OperandKind kinds[3];
+        uint32_t operands[3];
+    };
+
+    static_assert(sizeof(Instr) == 16, "LinearTAC::Instr must stay fixed width");
+
+    // A function's variables are numbered from 0 in the order they first
+    // appear, and vars[first_var + n] is the string id of the name of
+    // variable n
+    struct Function {
+        uint32_t name;
+        uint32_t first;
+        uint32_t count;
+        uint32_t first_var;
+        uint32_t num_vars;
+        Location loc;
+    };
+
+    // A read-only run of records, in buffers the encoder filled or in a
+    // mapped file
+    template <typename T>
+    struct Records {
+        const T* first = nullptr;
+        size_t count = 0;
+
+        const T* data() const { return first; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const T* begin() const { return first; }
+        const T* end() const { return first + count; }
+        const T& front() const { return first[0]; }
+        const T& operator[](size_t idx) const { return first[idx]; }
+    };
+
+    // Source locations are kept in a side table parallel to code, so the
+    // instructions themselves stay dense. Copies share the storage the
+    // records live in, which is released with the last of them.
+    struct Program {
+        Records<Function> functions;
+        Records<Instr> code;
+        Records<Location> locs;
+        Records<uint32_t> vars;
+        std::vector<std::string_view> strings;
+        uint32_t source = NO_STRING;
+        std::shared_ptr<const void> storage;
+    };
+
+    Program encode(const TAC::Program& p);
+
+    TAC::Program decode(const Program& p);
+
+    bool write(const Program& p, const std::string& path);
+
+    std::optional<Program> read(const std::string& path);
+}
+
+#endif
@@ -0,0 +1,1801 @@
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <variant>
+#include <optional>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <tuple>
+#include <stdexcept>
+#include "tac.hpp"
+#include "asmtree.hpp"
+#include "passes.hpp"
+#include "profile.hpp"
+#include "cfg.hpp"
+
+template<class... Ts> struct overloaded : Ts... {
+    using Ts::operator()...;
+};
+
+template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+static const std::vector<std::string> pass_names = {
+    "mem2reg",
+    "fold-constants",
+    "thread-jumps",
+    "remove-unreachable",
+    "dce",
+    "inline",
+    "layout-blocks",
+    "reuse-slots",
+    "drop-self-moves",
+};
+
+Passes::Options::Options() : level(0), inline_threshold(20) {}
+
+// Matches flag or flag=path
+bool parse_path(std::string_view arg, std::string_view flag, std::string& path) {
+    if (arg.substr(0, flag.size()) != flag) {
+        return false;
+    }
+
+    arg.remove_prefix(flag.size());
+    if (arg.empty()) {
+        path = Profile::DEFAULT_PATH;
+        return true;
+    }
+    if (arg[0] == '=' && arg.size() > 1) {
+        path = std::string(arg.substr(1));
+        return true;
+    }
+    return false;
+}
+
+bool Passes::Options::parse(std::string_view arg) {
+    if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+        level = arg[2] - '0';
+        return true;
+    }
+
+    if (parse_path(arg, "-fprofile-generate", profile_generate) || parse_path(arg, "-fprofile-use", profile_use)) {
+        return true;
+    }
+
+    static constexpr std::string_view threshold_flag = "-finline-threshold=";
+    if (arg.substr(0, threshold_flag.size()) == threshold_flag) {
+        std::string_view digits = arg.substr(threshold_flag.size());
+        if (digits.empty() || digits.size() > 9 || 
+                !std::all_of(digits.begin(), digits.end(), [](char c) -> bool { return c >= '0' && c <= '9'; })) {
+            return false;
+        }
+        inline_threshold = std::stoi(std::string(digits));
+        return true;
+    }
+
+    bool on = true;
+    if (arg.substr(0, 5) == "-fno-") {
+        arg.remove_prefix(5);
+        on = false;
+    } else if (arg.substr(0, 2) == "-f") {
+        arg.remove_prefix(2);
+    } else {
+        return false;
+    }
+
+    std::string name = std::string(arg);
+    if (std::find(pass_names.begin(), pass_names.end(), name) == pass_names.end()) {
+        return false;
+    }
+
+    overrides[name] = on;
+    return true;
+}
+
+bool Passes::Options::enabled(const std::string& name, int min_level) const {
+    auto it = overrides.find(name);
+    if (it != overrides.end()) {
+        return it->second;
+    }
+    return level >= min_level;
+}
+
+// Local passes rewrite one instruction at a time, appending the result to
+// the output vector; adjacent local passes are fused into a single walk over
+// each block, and start over at every block, so nothing they learn is carried
+// across a jump. Each instruction carries the index it had in its block
+// before the walk, which is what analyses requested by local passes are
+// keyed on.
+template <typename Instr>
+struct Local {
+    std::function<void(Instr&&, size_t, std::vector<Instr>&)> rewrite;
+    std::function<void(std::vector<Instr>&)> finish;
+};
+
+// Global passes see the whole function and return whether they changed it
+template <typename Code, typename Instr, typename Analyses>
+struct Pass {
+    std::string name;
+    int level;
+    bool required;
+    std::function<Local<Instr>(const std::vector<Instr>&, Analyses&)> local;
+    std::function<bool(Code&, Analyses&)> global;
+};
+
+// An ASMTree function is already laid out as a single sequence, which local
+// passes walk as one block
+template <typename F>
+void for_each_block(std::vector<ASMTree::Instr>& code, F&& func) {
+    func(code);
+}
+
+template <typename F>
+void for_each_block(TAC::Function& f, F&& func) {
+    for (auto& b : f.blocks) {
+        func(b.instructions);
+    }
+}
+
+template <typename Code, typename Instr, typename Analyses>
+class PassManager {
+    std::vector<Pass<Code, Instr, Analyses>> passes;
+
+    void apply(std::vector<Local<Instr>>& group, std::vector<std::vector<Instr>>& scratch,
+            size_t stage, Instr&& i, size_t origin, std::vector<Instr>& out) {
+        if (stage == group.size()) {
+            out.push_back(std::move(i));
+            return;
+        }
+
+        std::vector<Instr>& buf = scratch[stage];
+        buf.clear();
+        group[stage].rewrite(std::move(i), origin, buf);
+
+        for (auto& j : buf) {
+            apply(group, scratch, stage + 1, std::move(j), origin, out);
+        }
+    }
+
+    void flush(std::vector<const Pass<Code, Instr, Analyses>*>& group, Code& code, Analyses& analyses) {
+        if (group.empty()) {
+            return;
+        }
+
+        std::vector<std::vector<Instr>> scratch(group.size());
+
+        for_each_block(code, [this, &group, &scratch, &analyses](std::vector<Instr>& block) -> void {
+            std::vector<Local<Instr>> locals;
+            locals.reserve(group.size());
+            for (const auto* pass : group) {
+                locals.push_back(pass->local(block, analyses));
+            }
+
+            std::vector<Instr> out;
+            out.reserve(block.size());
+
+            for (size_t origin = 0; origin < block.size(); ++origin) {
+                apply(locals, scratch, 0, std::move(block[origin]), origin, out);
+            }
+
+            for (auto& l : locals) {
+                if (l.finish) {
+                    l.finish(out);
+                }
+            }
+
+            block = std::move(out);
+        });
+
+        analyses.invalidate();
+        group.clear();
+    }
+
+public:
+    void add(Pass<Code, Instr, Analyses> pass) {
+        passes.push_back(std::move(pass));
+    }
+
+    void run(Code& code, Analyses& analyses, const Passes::Options& opts) {
+        std::vector<const Pass<Code, Instr, Analyses>*> group;
+
+        for (const auto& pass : passes) {
+            if (!pass.required && !opts.enabled(pass.name, pass.level)) {
+                continue;
+            }
+
+            if (pass.local) {
+                group.push_back(&pass);
+                continue;
+            }
+
+            flush(group, code, analyses);
+            if (pass.global(code, analyses)) {
+                analyses.invalidate();
+            }
+        }
+
+        flush(group, code, analyses);
+    }
+};
+
+// Analyses are computed on first request and cached until a pass changes the code
+
+using UseCounts = std::unordered_map<std::string, int>;
+
+class TACAnalyses {
+    std::optional<UseCounts> uses;
+    std::optional<CFG::Graph> cfg;
+    std::optional<CFG::Dominators> dom;
+
+public:
+    const UseCounts& use_counts(const TAC::Function& f) {
+        if (uses) {
+            return *uses;
+        }
+
+        uses.emplace();
+        for (const auto& b : f.blocks) {
+            for (const auto& i : b.instructions) {
+                for (const auto* src : TAC::sources(i)) {
+                    if (const auto* w = std::get_if<TAC::Var>(src)) {
+                        ++(*uses)[w->identifier];
+                    }
+                }
+            }
+        }
+
+        return *uses;
+    }
+
+    const CFG::Graph& graph(const TAC::Function& f) {
+        if (!cfg) {
+            cfg.emplace(f);
+        }
+        return *cfg;
+    }
+
+    const CFG::Dominators& dominators(const TAC::Function& f) {
+        if (!dom) {
+            dom.emplace(graph(f));
+        }
+        return *dom;
+    }
+
+    void invalidate() {
+        uses.reset();
+        cfg.reset();
+        dom.reset();
+    }
+};
+
+// Visits operands in the order the instruction reads them
+template <typename I, typename F>
+void for_each_operand(I& i, F&& func) {
+    std::visit([&func](auto& instr) -> void {
+        using T = std::decay_t<decltype(instr)>;
+        if constexpr (std::is_same_v<T, ASMTree::Mov> || std::is_same_v<T, ASMTree::Cmp> 
+                || std::is_same_v<T, ASMTree::Binary>) {
+            func(instr.src);
+            func(instr.dst);
+        } else if constexpr (std::is_same_v<T, ASMTree::Unary> || std::is_same_v<T, ASMTree::Push> 
+                || std::is_same_v<T, ASMTree::Idiv> || std::is_same_v<T, ASMTree::WideMul>) {
+            func(instr.operand);
+        } else if constexpr (std::is_same_v<T, ASMTree::Lea>) {
+            func(instr.base);
+            func(instr.index);
+            func(instr.dst);
+        } else if constexpr (std::is_same_v<T, ASMTree::SetCC>) {
+            func(instr.dst);
+        }
+    }, i);
+}
+
+// The instructions each pseudo needs its own slot for: from the first to the
+// last one at which it is mentioned or live. mention numbers the pseudos in
+// the order they are first mentioned, which unlike their names does not
+// depend on what else was compiled before.
+struct LiveRange {
+    size_t first;
+    size_t last;
+    size_t mention;
+};
+
+using LiveRanges = std::unordered_map<std::string, LiveRange>;
+
+// A fixed-size set of pseudo ids, one bit each
+using Bits = std::vector<uint64_t>;
+
+template <typename F>
+void for_each_bit(const Bits& bits, F&& func) {
+    for (size_t w = 0; w < bits.size(); ++w) {
+        for (uint64_t word = bits[w]; word; word &= word - 1) {
+            func(w * 64 + static_cast<size_t>(__builtin_ctzll(word)));
+        }
+    }
+}
+
+// Liveness is solved per basic block rather than per instruction, so the
+// sets take space for each block and not for each instruction. A pseudo's
+// range only needs the ends of the stretch it is live for in a block,
+// which are the block's edges when it is live across them and otherwise
+// the instructions that mention it.
+LiveRanges compute_live_ranges(const std::vector<ASMTree::Instr>& code) {
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<std::string> names;
+    std::vector<std::vector<size_t>> uses(code.size());
+    std::vector<std::vector<size_t>> defs(code.size());
+    std::unordered_map<std::string, size_t> labels;
+
+    auto id = [&ids, &names](const ASMTree::Operand& op) -> size_t {
+        const auto* p = std::get_if<ASMTree::Pseudo>(&op);
+        if (!p) {
+            return CFG::NONE;
+        }
+        auto [it, inserted] = ids.try_emplace(p->identifier, names.size());
+        if (inserted) {
+            names.push_back(p->identifier);
+        }
+        return it->second;
+    };
+
+    // Blocks start at the first instruction, at every label and after
+    // every jump or return
+    std::vector<size_t> begins;
+    for (size_t idx = 0; idx < code.size(); ++idx) {
+        auto use = [&id, &uses, idx](const ASMTree::Operand& op) -> void {
+            if (size_t v = id(op); v != CFG::NONE) {
+                uses[idx].push_back(v);
+            }
+        };
+        auto def = [&id, &defs, idx](const ASMTree::Operand& op) -> void {
+            if (size_t v = id(op); v != CFG::NONE) {
+                defs[idx].push_back(v);
+            }
+        };
+
+        bool after_jump = idx > 0 && (std::holds_alternative<ASMTree::Jmp>(code[idx - 1]) 
+            || std::holds_alternative<ASMTree::JmpCC>(code[idx - 1]) || std::holds_alternative<ASMTree::Ret>(code[idx - 1]));
+        if (idx == 0 || after_jump || std::holds_alternative<ASMTree::Label>(code[idx])) {
+            begins.push_back(idx);
+        }
+
+        std::visit(
+            overloaded {
+                [&use, &def](const ASMTree::Mov& m) -> void {
+                    use(m.src);
+                    def(m.dst);
+                },
+                [&use](const ASMTree::Unary& u) -> void { use(u.operand); },
+                [&use](const ASMTree::Binary& b) -> void {
+                    use(b.src);
+                    use(b.dst);
+                },
+                [&use, &def](const ASMTree::Lea& l) -> void {
+                    use(l.base);
+                    use(l.index);
+                    def(l.dst);
+                },
+                [&use](const ASMTree::Idiv& i) -> void { use(i.operand); },
+                [&use](const ASMTree::WideMul& m) -> void { use(m.operand); },
+                [&use](const ASMTree::Push& p) -> void { use(p.operand); },
+                [&use](const ASMTree::Cmp& c) -> void {
+                    use(c.src);
+                    use(c.dst);
+                },
+                // Only the low byte is written, so the rest must still be there
+                [&use](const ASMTree::SetCC& s) -> void { use(s.dst); },
+                [&labels, &begins](const ASMTree::Label& l) -> void { labels[l.name] = begins.size() - 1; },
+                [](const auto&) -> void {}
+            }, code[idx]
+        );
+    }
+
+    size_t num_blocks = begins.size();
+    begins.push_back(code.size());
+
+    std::vector<std::vector<size_t>> succs(num_blocks);
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const ASMTree::Instr& last = code[begins[b + 1] - 1];
+        bool falls_through = b + 1 < num_blocks;
+        if (const auto* j = std::get_if<ASMTree::Jmp>(&last)) {
+            succs[b].push_back(labels.at(j->target));
+            falls_through = false;
+        } else if (const auto* j = std::get_if<ASMTree::JmpCC>(&last)) {
+            succs[b].push_back(labels.at(j->target));
+        } else if (std::holds_alternative<ASMTree::Ret>(last)) {
+            falls_through = false;
+        }
+        if (falls_through) {
+            succs[b].push_back(b + 1);
+        }
+    }
+
+    // What each block reads before writing it, and what it writes
+    size_t words = (names.size() + 63) / 64;
+    std::vector<Bits> gen(num_blocks, Bits(words));
+    std::vector<Bits> kill(num_blocks, Bits(words));
+    for (size_t b = 0; b < num_blocks; ++b) {
+        for (size_t idx = begins[b + 1]; idx-- > begins[b];) {
+            for (size_t v : defs[idx]) {
+                gen[b][v / 64] &= ~(uint64_t(1) << (v % 64));
+                kill[b][v / 64] |= uint64_t(1) << (v % 64);
+            }
+            for (size_t v : uses[idx]) {
+                gen[b][v / 64] |= uint64_t(1) << (v % 64);
+            }
+        }
+    }
+
+    // Backwards dataflow to a fixed point; walking in reverse lets
+    // straight-line code settle in a single pass
+    std::vector<Bits> live_in = gen;
+    std::vector<Bits> live_out(num_blocks, Bits(words));
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = num_blocks; b-- > 0;) {
+            Bits& out = live_out[b];
+            for (size_t s : succs[b]) {
+                for (size_t w = 0; w < words; ++w) {
+                    out[w] |= live_in[s][w];
+                }
+            }
+
+            for (size_t w = 0; w < words; ++w) {
+                uint64_t in = gen[b][w] | (out[w] & ~kill[b][w]);
+                if (in != live_in[b][w]) {
+                    live_in[b][w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<LiveRange> ranges(names.size(), LiveRange{CFG::NONE, 0, 0});
+    auto extend = [&ranges](size_t v, size_t idx) -> void {
+        ranges[v].first = std::min(ranges[v].first, idx);
+        ranges[v].last = std::max(ranges[v].last, idx);
+    };
+
+    for (size_t b = 0; b < num_blocks; ++b) {
+        size_t first = begins[b];
+        size_t last = begins[b + 1] - 1;
+        for_each_bit(live_in[b], [&extend, first](size_t v) -> void { extend(v, first); });
+        for_each_bit(live_out[b], [&extend, last](size_t v) -> void { extend(v, last); });
+
+        for (size_t idx = last + 1; idx-- > first;) {
+            for (size_t v : uses[idx]) {
+                extend(v, idx);
+            }
+            for (size_t v : defs[idx]) {
+                extend(v, idx);
+            }
+        }
+    }
+
+    LiveRanges result;
+    for (size_t v = 0; v < names.size(); ++v) {
+        ranges[v].mention = v;
+        result.emplace(std::move(names[v]), ranges[v]);
+    }
+    return result;
+}
+
+class ASMAnalyses {
+    std::optional<LiveRanges> ranges;
+
+public:
+    // Liveness follows jumps, so a value carried around a loop keeps its
+    // slot for the whole loop
+    const LiveRanges& live_ranges(const std::vector<ASMTree::Instr>& code) {
+        if (!ranges) {
+            ranges = compute_live_ranges(code);
+        }
+        return *ranges;
+    }
+
+    void invalidate() {
+        ranges.reset();
+    }
+};
+
+int fold(TAC::Unary::UnOp op, int val) {
+    switch (op) {
+        case TAC::Unary::UnOp::COMPLEMENT:
+            return ~val;
+        case TAC::Unary::UnOp::NEGATE:
+            // Wraps like the generated negl instead of overflowing
+            return static_cast<int>(0u - static_cast<unsigned>(val));
+        case TAC::Unary::UnOp::NOT:
+            return val == 0;
+    }
+    return val;
+}
+
+// Division that would trap at run time is left for the program to do
+std::optional<int> fold(TAC::Binary::BinOp op, int lhs, int rhs) {
+    // Arithmetic wraps like the generated code instead of overflowing
+    unsigned a = static_cast<unsigned>(lhs);
+    unsigned b = static_cast<unsigned>(rhs);
+    switch (op) {
+        case TAC::Binary::BinOp::ADD:
+            return static_cast<int>(a + b);
+        case TAC::Binary::BinOp::SUBTRACT:
+            return static_cast<int>(a - b);
+        case TAC::Binary::BinOp::MULTIPLY:
+            return static_cast<int>(a * b);
+        case TAC::Binary::BinOp::DIVIDE:
+        case TAC::Binary::BinOp::REMAINDER:
+            if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+                return std::nullopt;
+            }
+            return op == TAC::Binary::BinOp::DIVIDE ? lhs / rhs : lhs % rhs;
+        case TAC::Binary::BinOp::EQUAL:
+            return lhs == rhs;
+        case TAC::Binary::BinOp::NOT_EQUAL:
+            return lhs != rhs;
+        case TAC::Binary::BinOp::LESS:
+            return lhs < rhs;
+        case TAC::Binary::BinOp::LESS_EQUAL:
+            return lhs <= rhs;
+        case TAC::Binary::BinOp::GREATER:
+            return lhs > rhs;
+        case TAC::Binary::BinOp::GREATER_EQUAL:
+            return lhs >= rhs;
+    }
+    return std::nullopt;
+}
+
+// Calls func on each of the phis that open block
+template <typename Block, typename F>
+void for_each_phi(Block& block, F&& func) {
+    for (auto& i : block.instructions) {
+        auto* phi = std::get_if<TAC::Phi>(&i);
+        if (!phi) {
+            break;
+        }
+        func(*phi);
+    }
+}
+
+bool has_phis(const TAC::Block& block) {
+    return !block.instructions.empty() && std::holds_alternative<TAC::Phi>(block.instructions.front());
+}
+
+Location location(const TAC::Instr& i) {
+    return std::visit([](const auto& instr) -> Location {
+        if constexpr (std::is_same_v<std::decay_t<decltype(instr)>, std::monostate>) {
+            return Location{};
+        } else {
+            return instr.loc;
+        }
+    }, i);
+}
+
+// Points the edges from block's terminator that go to from at to instead
+void redirect(TAC::Block& block, size_t from, size_t to) {
+    if (block.instructions.empty()) {
+        return;
+    }
+    if (auto* j = std::get_if<TAC::Jump>(&block.instructions.back())) {
+        j->target = j->target == from ? to : j->target;
+    } else if (auto* br = std::get_if<TAC::Branch>(&block.instructions.back())) {
+        br->if_true = br->if_true == from ? to : br->if_true;
+        br->if_false = br->if_false == from ? to : br->if_false;
+    }
+}
+
+// Puts f into SSA form, after Cytron et al.: each assignment to a variable
+// gets a name of its own, and where assignments along different paths
+// meet, a phi chooses between them. Phis go at the iterated dominance
+// frontier of the blocks assigning a variable, and only for variables some
+// block reads before assigning, as no other can be live into a block.
+// Copies go away, with reads of their destination reading their source
+// instead. A read that no assignment reaches along some path, of a
+// parameter or an uninitialized local, keeps the variable's own name.
+bool promote_variables(TAC::Function& f, TACAnalyses& analyses) {
+    if (f.blocks.empty()) {
+        return false;
+    }
+
+    // A phi in the entry would have no value for the way in from outside,
+    // so an entry that is jumped back to moves to the end behind a new one
+    if (!analyses.graph(f).preds[0].empty()) {
+        size_t moved = f.blocks.size();
+        f.blocks.push_back(std::move(f.blocks[0]));
+        for (auto& block : f.blocks) {
+            redirect(block, 0, moved);
+            for_each_phi(block, [moved](TAC::Phi& phi) -> void {
+                for (auto& in : phi.incoming) {
+                    in.first = in.first == 0 ? moved : in.first;
+                }
+            });
+        }
+        // The entry keeps the origin, so that its count stays the count of calls
+        f.blocks[0] = TAC::Block{};
+        f.blocks[0].instructions.emplace_back(std::in_place_type<TAC::Jump>, moved, f.loc);
+        f.blocks[0].origin.swap(f.blocks[moved].origin);
+        analyses.invalidate();
+    }
+
+    const CFG::Graph& g = analyses.graph(f);
+    const CFG::Dominators& dom = analyses.dominators(f);
+
+    // Every variable by number, the blocks assigning each, and whether any
+    // block reads it before assigning it
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<std::string> names;
+    std::vector<std::vector<size_t>> defs;
+    std::vector<bool> global;
+    std::vector<size_t> assigned_in;
+    auto id = [&](const std::string& var) -> size_t {
+        auto [it, inserted] = ids.try_emplace(var, names.size());
+        if (inserted) {
+            names.push_back(var);
+            defs.emplace_back();
+            global.push_back(false);
+            assigned_in.push_back(CFG::NONE);
+        }
+        return it->second;
+    };
+
+    for (size_t b : CFG::reverse_postorder(g)) {
+        for (const auto& i : f.blocks[b].instructions) {
+            bool phi = std::holds_alternative<TAC::Phi>(i);
+            for (const auto* src : TAC::sources(i)) {
+                if (const auto* w = std::get_if<TAC::Var>(src)) {
+                    size_t v = id(w->identifier);
+                    global[v] = global[v] || phi || assigned_in[v] != b;
+                }
+            }
+            if (const TAC::Var* dst = TAC::destination(i)) {
+                size_t v = id(dst->identifier);
+                if (assigned_in[v] != b) {
+                    assigned_in[v] = b;
+                    defs[v].push_back(b);
+                }
+            }
+        }
+    }
+
+    // Each new phi starts out reading the variable's own name from every
+    // predecessor, and renaming fills in the value reaching it from each
+    std::vector<std::vector<TAC::Instr>> phis(f.blocks.size());
+    std::vector<size_t> has_phi(f.blocks.size(), CFG::NONE);
+    std::vector<size_t> queued(f.blocks.size(), CFG::NONE);
+    bool changed = false;
+
+    for (size_t v = 0; v < names.size(); ++v) {
+        if (defs[v].empty()) {
+            continue;
+        }
+        changed = true;
+        if (!global[v]) {
+            continue;
+        }
+
+        std::vector<size_t> work = defs[v];
+        for (size_t b : work) {
+            queued[b] = v;
+        }
+        while (!work.empty()) {
+            size_t b = work.back();
+            work.pop_back();
+
+            for (size_t d : dom.frontier[b]) {
+                if (has_phi[d] == v) {
+                    continue;
+                }
+                has_phi[d] = v;
+
+                std::vector<std::pair<size_t, TAC::Val>> incoming;
+                for (size_t p : g.preds[d]) {
+                    bool listed = std::any_of(incoming.begin(), incoming.end(), 
+                        [p](const std::pair<size_t, TAC::Val>& in) -> bool { return in.first == p; });
+                    if (dom.idom[p] != CFG::NONE && !listed) {
+                        incoming.emplace_back(p, TAC::Var(names[v]));
+                    }
+                }
+                phis[d].emplace_back(std::in_place_type<TAC::Phi>, std::move(incoming), TAC::Var(names[v]), 
+                    location(f.blocks[d].instructions.front()));
+
+                if (queued[d] != v) {
+                    queued[d] = v;
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+
+    for (size_t b = 0; b < f.blocks.size(); ++b) {
+        auto& code = f.blocks[b].instructions;
+        code.insert(code.begin(), std::make_move_iterator(phis[b].begin()), std::make_move_iterator(phis[b].end()));
+    }
+
+    // Renaming walks the dominator tree, so the value of each variable on
+    // top of its stack is the one from the closest assignment above
+    std::vector<std::vector<TAC::Val>> stacks(names.size());
+    size_t version {};
+    auto fresh = [&ids, &names, &version](size_t v) -> std::string {
+        std::string name;
+        do {
+            name = names[v] + ".v" + std::to_string(version++);
+        } while (ids.count(name));
+        return name;
+    };
+    auto current = [&ids, &stacks](TAC::Val& val) -> void {
+        const auto* w = std::get_if<TAC::Var>(&val);
+        auto it = w ? ids.find(w->identifier) : ids.end();
+        if (it != ids.end() && !stacks[it->second].empty()) {
+            val = stacks[it->second].back();
+        }
+    };
+
+    struct Visit {
+        size_t block;
+        size_t next;
+        std::vector<size_t> pushed;
+    };
+    std::vector<Visit> walk;
+    walk.push_back(Visit{0, 0, {}});
+
+    while (!walk.empty()) {
+        size_t b = walk.back().block;
+
+        if (walk.back().next == 0) {
+            std::vector<size_t>& pushed = walk.back().pushed;
+            auto& code = f.blocks[b].instructions;
+
+            for (auto& i : code) {
+                if (!std::holds_alternative<TAC::Phi>(i)) {
+                    for (auto* src : TAC::sources(i)) {
+                        current(*src);
+                    }
+                }
+
+                TAC::Var* dst = TAC::destination(i);
+                if (!dst) {
+                    continue;
+                }
+                size_t v = ids.at(dst->identifier);
+                pushed.push_back(v);
+
+                if (auto* c = std::get_if<TAC::Copy>(&i)) {
+                    stacks[v].push_back(std::move(c->src));
+                    i = std::monostate{};
+                    continue;
+                }
+                dst->identifier = fresh(v);
+                stacks[v].push_back(*dst);
+            }
+            code.erase(std::remove_if(code.begin(), code.end(), [](const TAC::Instr& i) -> bool {
+                return std::holds_alternative<std::monostate>(i);
+            }), code.end());
+
+            // A branch with both sides going to the same block still only
+            // gives its phis one value
+            std::vector<size_t> succs = g.succs[b];
+            std::sort(succs.begin(), succs.end());
+            succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+            for (size_t s : succs) {
+                for_each_phi(f.blocks[s], [&current, b](TAC::Phi& phi) -> void {
+                    for (auto& in : phi.incoming) {
+                        if (in.first == b) {
+                            current(in.second);
+                        }
+                    }
+                });
+            }
+        }
+
+        Visit& visit = walk.back();
+        if (visit.next < dom.children[b].size()) {
+            size_t c = dom.children[b][visit.next++];
+            walk.push_back(Visit{c, 0, {}});
+            continue;
+        }
+
+        for (size_t v : visit.pushed) {
+            stacks[v].pop_back();
+        }
+        walk.pop_back();
+    }
+
+    return changed;
+}
+
+// Folds operators on constants into copies and propagates constants. A
+// variable assigned only once holds its constant in every block that
+// assignment dominates; one assigned more than once is only followed to the
+// end of its block. Blocks are visited in reverse postorder, so each is seen
+// after the assignments that dominate it. A phi reads each value at the end
+// of the block it comes from, and folds when all of them are the same
+// constant. The copies stay for other reads until dce finds them unused.
+bool fold_constants(TAC::Function& f, TACAnalyses& analyses) {
+    const CFG::Dominators& dom = analyses.dominators(f);
+
+    std::unordered_map<std::string, int> assignments;
+    for (const auto& b : f.blocks) {
+        for (const auto& i : b.instructions) {
+            if (const TAC::Var* dst = TAC::destination(i)) {
+                ++assignments[dst->identifier];
+            }
+        }
+    }
+
+    struct Known {
+        size_t block;
+        int val;
+    };
+    std::unordered_map<std::string, Known> once;
+    bool changed = false;
+
+    for (size_t b : CFG::reverse_postorder(analyses.graph(f))) {
+        std::unordered_map<std::string, int> values;
+
+        auto substitute = [&once, &values, &dom, &changed, b](TAC::Val& v) -> void {
+            const auto* w = std::get_if<TAC::Var>(&v);
+            if (!w) {
+                return;
+            }
+
+            if (auto it = values.find(w->identifier); it != values.end()) {
+                v = TAC::Constant(it->second);
+                changed = true;
+            } else if (auto it = once.find(w->identifier); it != once.end() && dom.dominates(it->second.block, b)) {
+                v = TAC::Constant(it->second.val);
+                changed = true;
+            }
+        };
+
+        auto substitute_from = [&once, &dom, &changed](size_t pred, TAC::Val& v) -> void {
+            const auto* w = std::get_if<TAC::Var>(&v);
+            auto it = w ? once.find(w->identifier) : once.end();
+            if (it != once.end() && dom.dominates(it->second.block, pred)) {
+                v = TAC::Constant(it->second.val);
+                changed = true;
+            }
+        };
+        bool phis_folded = false;
+
+        for (auto& i : f.blocks[b].instructions) {
+            std::optional<TAC::Instr> folded;
+
+            std::visit(
+                overloaded {
+                    [&substitute](TAC::Return& r) -> void { substitute(r.val); },
+                    [&substitute, &folded](TAC::Unary& u) -> void {
+                        substitute(u.src);
+                        if (const auto* c = std::get_if<TAC::Constant>(&u.src)) {
+                            folded.emplace(std::in_place_type<TAC::Copy>, TAC::Constant(fold(u.op, c->val)), u.dst, u.loc);
+                        }
+                    },
+                    [&substitute, &folded](TAC::Binary& bin) -> void {
+                        substitute(bin.src1);
+                        substitute(bin.src2);
+                        const auto* c1 = std::get_if<TAC::Constant>(&bin.src1);
+                        const auto* c2 = std::get_if<TAC::Constant>(&bin.src2);
+                        std::optional<int> val = c1 && c2 ? fold(bin.op, c1->val, c2->val) : std::nullopt;
+                        if (val) {
+                            folded.emplace(std::in_place_type<TAC::Copy>, TAC::Constant(*val), bin.dst, bin.loc);
+                        }
+                    },
+                    [&substitute](TAC::Copy& c) -> void { substitute(c.src); },
+                    [&substitute](TAC::FunCall& c) -> void {
+                        for (auto& arg : c.args) {
+                            substitute(arg);
+                        }
+                    },
+                    [&substitute](TAC::Branch& br) -> void { substitute(br.cond); },
+                    // The value a phi already has, coming back around a
+                    // loop, does not stop it from folding
+                    [&substitute_from, &folded, &phis_folded](TAC::Phi& phi) -> void {
+                        std::optional<int> same;
+                        bool constant = true;
+                        for (auto& [pred, val] : phi.incoming) {
+                            substitute_from(pred, val);
+                            const auto* w = std::get_if<TAC::Var>(&val);
+                            if (w && w->identifier == phi.dst.identifier) {
+                                continue;
+                            }
+                            const auto* c = std::get_if<TAC::Constant>(&val);
+                            constant = constant && c && (!same || *same == c->val);
+                            same = c ? std::optional<int>(c->val) : same;
+                        }
+                        if (constant && same) {
+                            folded.emplace(std::in_place_type<TAC::Copy>, TAC::Constant(*same), phi.dst, phi.loc);
+                            phis_folded = true;
+                        }
+                    },
+                    [](auto&) -> void {}
+                }, i
+            );
+
+            if (folded) {
+                i = std::move(*folded);
+                changed = true;
+            }
+
+            const TAC::Var* dst = TAC::destination(i);
+            if (!dst) {
+                continue;
+            }
+
+            const auto* copy = std::get_if<TAC::Copy>(&i);
+            const auto* k = copy ? std::get_if<TAC::Constant>(&copy->src) : nullptr;
+            if (assignments[dst->identifier] == 1) {
+                if (k) {
+                    once.emplace(dst->identifier, Known{b, k->val});
+                }
+            } else if (k) {
+                values[dst->identifier] = k->val;
+            } else {
+                values.erase(dst->identifier);
+            }
+        }
+
+        // The copies of folded phis go after the phis still left
+        if (phis_folded) {
+            auto& code = f.blocks[b].instructions;
+            std::stable_partition(code.begin(), code.end(), [](const TAC::Instr& i) -> bool {
+                return std::holds_alternative<TAC::Phi>(i);
+            });
+        }
+    }
+
+    return changed;
+}
+
+// Removes the assignments nothing needs. Returns, branches and calls are
+// always needed, calls since the callee may have side effects, and so is
+// every assignment to a variable something needed reads. Marking from
+// those rather than counting reads also removes values that only feed each
+// other, like a loop's phi and its update when nothing reads either.
+bool eliminate_dead_code(TAC::Function& f, TACAnalyses&) {
+    std::unordered_map<std::string, std::vector<const TAC::Instr*>> defs;
+    std::vector<const TAC::Instr*> work;
+    for (const auto& b : f.blocks) {
+        for (const auto& i : b.instructions) {
+            const TAC::Var* dst = TAC::destination(i);
+            if (dst) {
+                defs[dst->identifier].push_back(&i);
+            }
+            if (!dst || std::holds_alternative<TAC::FunCall>(i)) {
+                work.push_back(&i);
+            }
+        }
+    }
+
+    std::unordered_set<std::string> needed;
+    while (!work.empty()) {
+        const TAC::Instr* i = work.back();
+        work.pop_back();
+        for (const auto* src : TAC::sources(*i)) {
+            const auto* w = std::get_if<TAC::Var>(src);
+            if (!w || !needed.insert(w->identifier).second) {
+                continue;
+            }
+            auto it = defs.find(w->identifier);
+            if (it != defs.end()) {
+                work.insert(work.end(), it->second.begin(), it->second.end());
+            }
+        }
+    }
+
+    bool changed = false;
+    for (auto& b : f.blocks) {
+        auto& code = b.instructions;
+        auto dead = std::remove_if(code.begin(), code.end(), [&needed](const TAC::Instr& i) -> bool {
+            const TAC::Var* dst = TAC::destination(i);
+            return dst && !std::holds_alternative<TAC::FunCall>(i) && !needed.count(dst->identifier);
+        });
+        changed = changed || dead != code.end();
+        code.erase(dead, code.end());
+    }
+
+    return changed;
+}
+
+// The constant code last assigns to var, if it is known at the end of code
+std::optional<int> known_value(const std::vector<TAC::Instr>& code, const std::string& var) {
+    for (size_t idx = code.size(); idx-- > 0;) {
+        const TAC::Var* dst = TAC::destination(code[idx]);
+        if (!dst || dst->identifier != var) {
+            continue;
+        }
+
+        const auto* c = std::get_if<TAC::Copy>(&code[idx]);
+        const auto* k = c ? std::get_if<TAC::Constant>(&c->src) : nullptr;
+        return k ? std::optional<int>(k->val) : std::nullopt;
+    }
+    return std::nullopt;
+}
+
+// Has the phis of block take from also what they take from via, for a new
+// edge from from that bypasses via
+void copy_incoming(TAC::Block& block, size_t via, size_t from, UseCounts& uses) {
+    for_each_phi(block, [via, from, &uses](TAC::Phi& phi) -> void {
+        for (size_t idx = 0; idx < phi.incoming.size(); ++idx) {
+            if (phi.incoming[idx].first != via) {
+                continue;
+            }
+            TAC::Val val = phi.incoming[idx].second;
+            if (const auto* w = std::get_if<TAC::Var>(&val)) {
+                ++uses[w->identifier];
+            }
+            phi.incoming.emplace_back(from, std::move(val));
+            break;
+        }
+    });
+}
+
+// Drops the values the phis of block take from from, once it is no longer
+// a predecessor
+void remove_incoming(TAC::Block& block, size_t from, UseCounts& uses) {
+    for_each_phi(block, [from, &uses](TAC::Phi& phi) -> void {
+        auto gone = std::remove_if(phi.incoming.begin(), phi.incoming.end(), 
+            [from, &uses](const std::pair<size_t, TAC::Val>& in) -> bool {
+                const auto* w = std::get_if<TAC::Var>(&in.second);
+                if (in.first == from && w) {
+                    --uses[w->identifier];
+                }
+                return in.first == from;
+            });
+        phi.incoming.erase(gone, phi.incoming.end());
+    });
+}
+
+// Sends jumps straight to where they end up: past blocks that only jump
+// on, through branches on a value the jumping block has just set to a
+// constant or a phi takes as a constant from it, and for branches that
+// always go one way, to that side only. A block with phis gets a value for
+// each new edge into it, the one it had for the edge the new one bypasses,
+// and cannot take a second edge from a block that already goes to it. A
+// branch is only bypassed when nothing past it reads its phis, since they
+// would not be assigned along the new edge.
+bool thread_jumps(TAC::Function& f, TACAnalyses& analyses) {
+    UseCounts uses = analyses.use_counts(f);
+    bool changed = false;
+
+    // The side of d's branch that control coming from from takes, when d
+    // holds nothing else but phis it can do without along that edge
+    auto bypass = [&f, &uses](size_t from, size_t d) -> size_t {
+        const auto& code = f.blocks[d].instructions;
+        const auto* br = code.empty() ? nullptr : std::get_if<TAC::Branch>(&code.back());
+        if (!br) {
+            return CFG::NONE;
+        }
+
+        const auto* w = std::get_if<TAC::Var>(&br->cond);
+        std::optional<int> known;
+        if (const auto* c = std::get_if<TAC::Constant>(&br->cond)) {
+            known = c->val;
+        } else if (w && code.size() == 1) {
+            known = known_value(f.blocks[from].instructions, w->identifier);
+        }
+
+        for (size_t idx = 0; idx + 1 < code.size(); ++idx) {
+            const auto* phi = std::get_if<TAC::Phi>(&code[idx]);
+            bool cond = phi && w && phi->dst.identifier == w->identifier;
+            if (!phi || uses[phi->dst.identifier] != (cond ? 1 : 0)) {
+                return CFG::NONE;
+            }
+            if (!cond) {
+                continue;
+            }
+            for (const auto& [pred, val] : phi->incoming) {
+                const auto* k = std::get_if<TAC::Constant>(&val);
+                if (pred == from && k) {
+                    known = k->val;
+                }
+            }
+        }
+
+        return known ? (*known != 0 ? br->if_true : br->if_false) : CFG::NONE;
+    };
+
+    // Follows the edge from from to target for as long as it can be sent
+    // further, stopping before it could go around a cycle forever; other is
+    // where from's branch goes on its other side
+    auto follow = [&f, &uses, &changed, &bypass](size_t from, size_t& target, size_t other) -> void {
+        for (size_t steps = 0; steps < f.blocks.size(); ++steps) {
+            const auto& code = f.blocks[target].instructions;
+            const auto* j = code.size() == 1 ? std::get_if<TAC::Jump>(&code[0]) : nullptr;
+            size_t next = j ? j->target : (target != other ? bypass(from, target) : CFG::NONE);
+            if (next == CFG::NONE || next == target || (next == other && has_phis(f.blocks[next]))) {
+                break;
+            }
+
+            copy_incoming(f.blocks[next], target, from, uses);
+            remove_incoming(f.blocks[target], from, uses);
+            target = next;
+            changed = true;
+        }
+    };
+
+    // Successors go first, so a chain of blocks that only jump on is
+    // walked once from its end rather than again from every block in it
+    std::vector<size_t> order = CFG::reverse_postorder(analyses.graph(f));
+    std::reverse(order.begin(), order.end());
+    std::vector<bool> ordered(f.blocks.size());
+    for (size_t x : order) {
+        ordered[x] = true;
+    }
+    for (size_t x = 0; x < f.blocks.size(); ++x) {
+        if (!ordered[x]) {
+            order.push_back(x);
+        }
+    }
+
+    for (size_t x : order) {
+        if (f.blocks[x].instructions.empty()) {
+            continue;
+        }
+        TAC::Instr& term = f.blocks[x].instructions.back();
+
+        if (auto* j = std::get_if<TAC::Jump>(&term)) {
+            follow(x, j->target, CFG::NONE);
+            continue;
+        }
+
+        auto* br = std::get_if<TAC::Branch>(&term);
+        if (!br) {
+            continue;
+        }
+        follow(x, br->if_true, br->if_false);
+        follow(x, br->if_false, br->if_true);
+
+        const auto* c = std::get_if<TAC::Constant>(&br->cond);
+        if (c || br->if_true == br->if_false) {
+            size_t target = !c || c->val != 0 ? br->if_true : br->if_false;
+            size_t dropped = target == br->if_true ? br->if_false : br->if_true;
+            if (dropped != target) {
+                remove_incoming(f.blocks[dropped], x, uses);
+            }
+            Location loc = br->loc;
+            term = TAC::Jump(target, loc);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Drops the blocks control never reaches, renumbering the rest in order,
+// along with the values phis take from them
+bool remove_unreachable(TAC::Function& f, TACAnalyses& analyses) {
+    std::vector<size_t> reachable = CFG::reverse_postorder(analyses.graph(f));
+    if (reachable.size() == f.blocks.size()) {
+        return false;
+    }
+
+    std::vector<size_t> renumbered(f.blocks.size(), CFG::NONE);
+    std::sort(reachable.begin(), reachable.end());
+    for (size_t idx = 0; idx < reachable.size(); ++idx) {
+        renumbered[reachable[idx]] = idx;
+    }
+
+    std::vector<TAC::Block> blocks;
+    blocks.reserve(reachable.size());
+    for (size_t b : reachable) {
+        blocks.push_back(std::move(f.blocks[b]));
+
+        TAC::Instr& term = blocks.back().instructions.back();
+        if (auto* j = std::get_if<TAC::Jump>(&term)) {
+            j->target = renumbered[j->target];
+        } else if (auto* br = std::get_if<TAC::Branch>(&term)) {
+            br->if_true = renumbered[br->if_true];
+            br->if_false = renumbered[br->if_false];
+        }
+
+        for_each_phi(blocks.back(), [&renumbered](TAC::Phi& phi) -> void {
+            auto gone = std::remove_if(phi.incoming.begin(), phi.incoming.end(), 
+                [&renumbered](const std::pair<size_t, TAC::Val>& in) -> bool {
+                    return renumbered[in.first] == CFG::NONE;
+                });
+            phi.incoming.erase(gone, phi.incoming.end());
+            for (auto& in : phi.incoming) {
+                in.first = renumbered[in.first];
+            }
+        });
+    }
+
+    f.blocks = std::move(blocks);
+    return true;
+}
+
+using CallGraph = std::vector<std::vector<size_t>>;
+
+CallGraph call_graph(const TAC::Program& p) {
+    std::unordered_map<std::string, size_t> indices;
+    for (size_t idx = 0; idx < p.functions.size(); ++idx) {
+        indices.emplace(p.functions[idx].identifier, idx);
+    }
+
+    CallGraph calls(p.functions.size());
+    for (size_t idx = 0; idx < p.functions.size(); ++idx) {
+        for (const auto& b : p.functions[idx].blocks) {
+            for (const auto& i : b.instructions) {
+                if (const auto* c = std::get_if<TAC::FunCall>(&i)) {
+                    auto it = indices.find(c->name);
+                    if (it != indices.end()) {
+                        calls[idx].push_back(it->second);
+                    }
+                }
+            }
+        }
+    }
+
+    return calls;
+}
+
+// Tarjan's algorithm completes each strongly connected component of the call
+// graph only after every component it calls into, so the components come out
+// callees first
+struct BottomUp {
+    const CallGraph& calls;
+    std::vector<int> index;
+    std::vector<int> low;
+    std::vector<bool> on_stack;
+    std::vector<size_t> stack;
+    int next;
+    std::vector<std::vector<size_t>> order;
+
+    BottomUp(const CallGraph& calls) : 
+        calls(calls), index(calls.size(), -1), low(calls.size()), on_stack(calls.size()), next(0) {
+        for (size_t v = 0; v < calls.size(); ++v) {
+            if (index[v] < 0) {
+                visit(v);
+            }
+        }
+    }
+
+    void visit(size_t v) {
+        index[v] = low[v] = next++;
+        stack.push_back(v);
+        on_stack[v] = true;
+
+        for (size_t w : calls[v]) {
+            if (index[w] < 0) {
+                visit(w);
+                low[v] = std::min(low[v], low[w]);
+            } else if (on_stack[w]) {
+                low[v] = std::min(low[v], index[w]);
+            }
+        }
+
+        if (low[v] != index[v]) {
+            return;
+        }
+
+        std::vector<size_t> component;
+        size_t w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            on_stack[w] = false;
+            component.push_back(w);
+        } while (w != v);
+        order.push_back(std::move(component));
+    }
+};
+
+// Every instruction counts, since without flow information any block may run
+size_t code_size(const TAC::Function& f) {
+    size_t size {};
+    for (const auto& b : f.blocks) {
+        size += b.instructions.size();
+    }
+    return size;
+}
+
+// What inlining adds to the caller: a copy per parameter and the body,
+// less the call and its argument setup, which go away. Constant arguments
+// are followed through the body as fold-constants would, and neither what
+// they fold nor the blocks only reachable past a branch they decide count.
+int inline_cost(const TAC::Function& callee, const std::vector<TAC::Val>& args) {
+    int setup = static_cast<int>(args.size() + 1);
+    bool constants = std::any_of(args.begin(), args.end(), [](const TAC::Val& v) -> bool {
+        return std::holds_alternative<TAC::Constant>(v);
+    });
+    if (!constants) {
+        return static_cast<int>(callee.params.size() + code_size(callee)) - setup;
+    }
+
+    std::unordered_map<std::string, int> assignments;
+    for (const auto& b : callee.blocks) {
+        for (const auto& i : b.instructions) {
+            if (const TAC::Var* dst = TAC::destination(i)) {
+                ++assignments[dst->identifier];
+            }
+        }
+    }
+
+    // Only variables assigned once keep the value they are known to have
+    std::unordered_map<std::string, int> known;
+    int size {};
+    for (size_t idx = 0; idx < callee.params.size(); ++idx) {
+        const auto* c = idx < args.size() ? std::get_if<TAC::Constant>(&args[idx]) : nullptr;
+        if (c && !assignments.count(callee.params[idx])) {
+            known.emplace(callee.params[idx], c->val);
+        } else {
+            ++size;
+        }
+    }
+    auto value = [&known](const TAC::Val& v) -> std::optional<int> {
+        if (const auto* c = std::get_if<TAC::Constant>(&v)) {
+            return c->val;
+        }
+        const auto* w = std::get_if<TAC::Var>(&v);
+        auto it = w ? known.find(w->identifier) : known.end();
+        return it == known.end() ? std::nullopt : std::optional<int>(it->second);
+    };
+
+    // In reverse postorder, so a phi has seen every incoming value except
+    // along back edges, which it then cannot fold
+    CFG::Graph g = CFG::Graph(callee);
+    std::vector<bool> reached(callee.blocks.size());
+    std::vector<bool> visited(callee.blocks.size());
+    for (size_t b : CFG::reverse_postorder(g)) {
+        visited[b] = true;
+        reached[b] = reached[b] || b == 0;
+        if (!reached[b]) {
+            continue;
+        }
+
+        for (const auto& i : callee.blocks[b].instructions) {
+            std::optional<int> folded = std::visit(overloaded {
+                [&value](const TAC::Unary& u) -> std::optional<int> {
+                    std::optional<int> v = value(u.src);
+                    return v ? std::optional<int>(fold(u.op, *v)) : std::nullopt;
+                },
+                [&value](const TAC::Binary& bin) -> std::optional<int> {
+                    std::optional<int> lhs = value(bin.src1);
+                    std::optional<int> rhs = value(bin.src2);
+                    return lhs && rhs ? fold(bin.op, *lhs, *rhs) : std::nullopt;
+                },
+                [&value](const TAC::Copy& c) -> std::optional<int> {
+                    return value(c.src);
+                },
+                [&value, &reached, &visited](const TAC::Phi& phi) -> std::optional<int> {
+                    std::optional<int> same;
+                    for (const auto& [pred, val] : phi.incoming) {
+                        if (pred < visited.size() && visited[pred] && !reached[pred]) {
+                            continue;
+                        }
+                        std::optional<int> v = pred < visited.size() && visited[pred] ? value(val) : std::nullopt;
+                        if (!v || (same && *same != *v)) {
+                            return std::nullopt;
+                        }
+                        same = v;
+                    }
+                    return same;
+                },
+                [&value, &reached](const TAC::Branch& br) -> std::optional<int> {
+                    std::optional<int> cond = value(br.cond);
+                    reached[br.if_true] = reached[br.if_true] || !cond || *cond != 0;
+                    reached[br.if_false] = reached[br.if_false] || !cond || *cond == 0;
+                    return std::nullopt;
+                },
+                [&reached](const TAC::Jump& j) -> std::optional<int> {
+                    reached[j.target] = true;
+                    return std::nullopt;
+                },
+                [](const auto&) -> std::optional<int> {
+                    return std::nullopt;
+                }
+            }, i);
+
+            const TAC::Var* dst = TAC::destination(i);
+            if (folded && dst && assignments[dst->identifier] == 1) {
+                known.emplace(dst->identifier, *folded);
+                continue;
+            }
+            ++size;
+        }
+    }
+
+    return size - setup;
+}
+
+// The most a call may grow its caller by. Under a profile, calls to
+// functions among the hottest get four times as much room, and calls to
+// functions that never ran are only inlined where the caller shrinks.
+int inline_threshold(const std::string& callee, const Passes::Options& opts) {
+    if (!opts.profile) {
+        return opts.inline_threshold;
+    }
+
+    auto it = opts.profile->counts.find(Profile::function_counter(callee));
+    if (it == opts.profile->counts.end()) {
+        return opts.inline_threshold;
+    }
+    if (it->second == 0) {
+        return 0;
+    }
+    return it->second >= opts.profile->hottest_function / 16 ? 4 * opts.inline_threshold : opts.inline_threshold;
+}
+
+// Appends a copy of callee's blocks to f for call, with every variable
+// given suffix so that repeated inlining never collides. Its returns copy
+// into the call's destination and jump on to block cont.
+void clone_callee(TAC::Function& f, const TAC::FunCall& call, const TAC::Function& callee, 
+        const std::string& suffix, size_t cont) {
+    auto rename = [&suffix](TAC::Val& v) -> void {
+        if (auto* w = std::get_if<TAC::Var>(&v)) {
+            w->identifier += suffix;
+        }
+    };
+
+    size_t base = f.blocks.size();
+    f.blocks.insert(f.blocks.end(), callee.blocks.begin(), callee.blocks.end());
+    for (size_t b = base; b < f.blocks.size(); ++b) {
+        std::vector<TAC::Instr> out;
+        out.reserve(f.blocks[b].instructions.size() + 1);
+
+        for (auto& i : f.blocks[b].instructions) {
+            std::visit(
+                overloaded {
+                    [&rename, &call, &i, cont, &out](TAC::Return& r) -> void {
+                        rename(r.val);
+                        Location loc = r.loc;
+                        out.emplace_back(std::in_place_type<TAC::Copy>, std::move(r.val), call.dst, loc);
+                        i = TAC::Jump(cont, loc);
+                    },
+                    [&rename, &suffix](TAC::Unary& u) -> void {
+                        rename(u.src);
+                        u.dst.identifier += suffix;
+                    },
+                    [&rename, &suffix](TAC::Binary& b) -> void {
+                        rename(b.src1);
+                        rename(b.src2);
+                        b.dst.identifier += suffix;
+                    },
+                    [&rename, &suffix](TAC::Copy& c) -> void {
+                        rename(c.src);
+                        c.dst.identifier += suffix;
+                    },
+                    [&rename, &suffix](TAC::FunCall& c) -> void {
+                        for (auto& arg : c.args) {
+                            rename(arg);
+                        }
+                        c.dst.identifier += suffix;
+                    },
+                    [&rename, base](TAC::Branch& br) -> void {
+                        rename(br.cond);
+                        br.if_true += base;
+                        br.if_false += base;
+                    },
+                    [base](TAC::Jump& j) -> void { j.target += base; },
+                    [&rename, &suffix, base](TAC::Phi& phi) -> void {
+                        for (auto& in : phi.incoming) {
+                            in.first += base;
+                            rename(in.second);
+                        }
+                        phi.dst.identifier += suffix;
+                    },
+                    [](std::monostate) -> void {}
+                }, i
+            );
+            out.push_back(std::move(i));
+        }
+
+        f.blocks[b].instructions = std::move(out);
+    }
+}
+
+// Replaces the calls at the given positions of block b, in increasing
+// order, with their callees' bodies, in one pass over the block. The block
+// is split at each call: the piece before it copies the arguments into the
+// parameters and jumps to the callee's cloned blocks, which go on to a new
+// block holding the next piece; only the first piece keeps b's origin.
+// Phis after the last piece take from it what they took from b.
+void inline_block(TAC::Function& f, size_t b, const std::vector<std::pair<size_t, const TAC::Function*>>& calls,
+        int& inlined) {
+    // Taken out whole, so that no piece keeps the storage of the block
+    std::vector<TAC::Instr> code;
+    code.swap(f.blocks[b].instructions);
+
+    size_t piece = b;
+    size_t from = 0;
+    for (const auto& [idx, callee] : calls) {
+        const TAC::FunCall& call = std::get<TAC::FunCall>(code[idx]);
+        std::string suffix = ".i" + std::to_string(inlined++);
+        size_t base = f.blocks.size();
+        size_t cont = base + callee->blocks.size();
+
+        std::vector<TAC::Instr> head;
+        head.reserve(idx - from + callee->params.size() + 1);
+        head.insert(head.end(), std::make_move_iterator(code.begin() + from), std::make_move_iterator(code.begin() + idx));
+        for (size_t param = 0; param < callee->params.size(); ++param) {
+            TAC::Val arg = param < call.args.size() ? call.args[param] : TAC::Val(TAC::Constant(0));
+            head.emplace_back(std::in_place_type<TAC::Copy>, std::move(arg), TAC::Var(callee->params[param] + suffix), call.loc);
+        }
+        head.emplace_back(std::in_place_type<TAC::Jump>, base, call.loc);
+        f.blocks[piece].instructions = std::move(head);
+
+        clone_callee(f, call, *callee, suffix, cont);
+        f.blocks.emplace_back();
+        piece = cont;
+        from = idx + 1;
+    }
+
+    f.blocks[piece].instructions.assign(std::make_move_iterator(code.begin() + from), std::make_move_iterator(code.end()));
+
+    for (size_t s : TAC::successors(f.blocks[piece])) {
+        for_each_phi(f.blocks[s], [b, piece](TAC::Phi& phi) -> void {
+            for (auto& in : phi.incoming) {
+                in.first = in.first == b ? piece : in.first;
+            }
+        });
+    }
+}
+
+struct StackAllocator {
+    bool reuse;
+    LiveRanges ranges;
+    // The pseudos whose ranges start and end at each instruction
+    std::vector<std::vector<std::string>> starts;
+    std::vector<std::vector<std::string>> ends;
+    std::unordered_map<std::string, int> table;
+    std::vector<int> free_slots;
+    int loc;
+    bool calls;
+
+    int slot(const std::string& identifier) {
+        auto it = table.find(identifier);
+        if (it != table.end()) {
+            return it->second;
+        }
+
+        int slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            loc -= sizeof(int);
+            slot = loc;
+            // TODO: When implementing support for more types,
+            // encode size information and change accordingly
+        }
+        table.emplace(identifier, slot);
+        return slot;
+    }
+
+    // Frees the slots of the pseudos last live at origin, either those
+    // already allocated before it or those that were born there
+    void release(size_t origin, bool born) {
+        for (const auto& identifier : ends[origin]) {
+            if ((ranges[identifier].first == origin) == born) {
+                free_slots.push_back(table.at(identifier));
+            }
+        }
+    }
+
+    void assign(ASMTree::Operand& op) {
+        if (auto* p = std::get_if<ASMTree::Pseudo>(&op)) {
+            op = ASMTree::Stack(slot(p->identifier));
+        }
+    }
+};
+
+Local<ASMTree::Instr> allocate_stack(const std::vector<ASMTree::Instr>& code, ASMAnalyses& analyses, bool reuse) {
+    auto state = std::make_shared<StackAllocator>();
+    state->reuse = reuse;
+    state->loc = 0;
+    state->calls = false;
+    if (reuse) {
+        state->ranges = analyses.live_ranges(code);
+        state->starts.resize(code.size());
+        state->ends.resize(code.size());
+        for (const auto& [identifier, range] : state->ranges) {
+            state->starts[range.first].push_back(identifier);
+            state->ends[range.last].push_back(identifier);
+        }
+        // Slots are handed out and freed in the same order whatever the
+        // pseudos are called
+        auto earlier = [&state](const std::string& a, const std::string& b) -> bool {
+            const LiveRange& ra = state->ranges.at(a);
+            const LiveRange& rb = state->ranges.at(b);
+            return std::tie(ra.first, ra.mention) < std::tie(rb.first, rb.mention);
+        };
+        for (auto& names : state->starts) {
+            std::sort(names.begin(), names.end(), earlier);
+        }
+        for (auto& names : state->ends) {
+            std::sort(names.begin(), names.end(), earlier);
+        }
+    }
+
+    Local<ASMTree::Instr> l;
+    // Instructions read before they write, so a value that dies here can
+    // hand its slot straight to one born here
+    l.rewrite = [state](ASMTree::Instr&& i, size_t origin, std::vector<ASMTree::Instr>& out) -> void {
+        if (state->reuse) {
+            state->release(origin, false);
+        }
+        for_each_operand(i, [&state](ASMTree::Operand& op) -> void {
+            state->assign(op);
+        });
+        if (state->reuse) {
+            // A value carried around a loop can be live here without
+            // being mentioned, and still needs its slot from here on
+            for (const auto& identifier : state->starts[origin]) {
+                state->slot(identifier);
+            }
+            state->release(origin, true);
+        }
+        state->calls = state->calls || std::holds_alternative<ASMTree::Call>(i);
+        out.push_back(std::move(i));
+    };
+    l.finish = [state](std::vector<ASMTree::Instr>& code) -> void {
+        if (code.empty()) {
+            return;
+        }
+        if (auto* as = std::get_if<ASMTree::AllocateStack>(&code[0])) {
+            // Only a function that makes calls has to keep %rsp 16-byte aligned
+            as->amount = state->calls ? (-state->loc + 15) / 16 * 16 : -state->loc;
+        }
+    };
+    return l;
+}
+
+bool same_location(const ASMTree::Operand& a, const ASMTree::Operand& b) {
+    if (const auto* sa = std::get_if<ASMTree::Stack>(&a)) {
+        const auto* sb = std::get_if<ASMTree::Stack>(&b);
+        return sb && sa->offset == sb->offset;
+    }
+    if (const auto* ra = std::get_if<ASMTree::Reg>(&a)) {
+        const auto* rb = std::get_if<ASMTree::Reg>(&b);
+        return rb && ra->r == rb->r;
+    }
+    return false;
+}
+
+Local<ASMTree::Instr> drop_self_moves(const std::vector<ASMTree::Instr>&, ASMAnalyses&) {
+    Local<ASMTree::Instr> l;
+    l.rewrite = [](ASMTree::Instr&& i, size_t, std::vector<ASMTree::Instr>& out) -> void {
+        const auto* m = std::get_if<ASMTree::Mov>(&i);
+        if (m && same_location(m->src, m->dst)) {
+            return;
+        }
+        out.push_back(std::move(i));
+    };
+    return l;
+}
+
+bool is_memory(const ASMTree::Operand& op) {
+    return std::holds_alternative<ASMTree::Stack>(op);
+}
+
+// At most one operand of an instruction can be in memory, cmpl cannot
+// compare into an immediate, imull cannot multiply into memory and idivl
+// cannot divide by an immediate, so those go through the scratch registers
+Local<ASMTree::Instr> fix_invalid_operands(const std::vector<ASMTree::Instr>&, ASMAnalyses&) {
+    Local<ASMTree::Instr> l;
+    l.rewrite = [](ASMTree::Instr&& instr, size_t, std::vector<ASMTree::Instr>& out) -> void {
+        if (auto* m = std::get_if<ASMTree::Mov>(&instr); m && is_memory(m->src) && is_memory(m->dst)) {
+            out.emplace_back(ASMTree::Mov(std::move(m->src), ASMTree::Reg::reg::R10, m->loc));
+            out.emplace_back(ASMTree::Mov(ASMTree::Reg::reg::R10, std::move(m->dst), m->loc));
+        } else if (auto* c = std::get_if<ASMTree::Cmp>(&instr); c && is_memory(c->src) && is_memory(c->dst)) {
+            out.emplace_back(ASMTree::Mov(std::move(c->src), ASMTree::Reg::reg::R10, c->loc));
+            out.emplace_back(ASMTree::Cmp(ASMTree::Reg::reg::R10, std::move(c->dst), c->loc));
+        } else if (c && std::holds_alternative<ASMTree::Imm>(c->dst)) {
+            out.emplace_back(ASMTree::Mov(std::move(c->dst), ASMTree::Reg::reg::R11, c->loc));
+            out.emplace_back(ASMTree::Cmp(std::move(c->src), ASMTree::Reg::reg::R11, c->loc));
+        } else if (auto* b = std::get_if<ASMTree::Binary>(&instr); 
+                b && b->op == ASMTree::Binary::BinOp::MULT && is_memory(b->dst)) {
+            out.emplace_back(ASMTree::Mov(b->dst, ASMTree::Reg::reg::R11, b->loc));
+            out.emplace_back(ASMTree::Binary(b->op, std::move(b->src), ASMTree::Reg::reg::R11, b->loc));
+            out.emplace_back(ASMTree::Mov(ASMTree::Reg::reg::R11, std::move(b->dst), b->loc));
+        } else if (b && is_memory(b->src) && is_memory(b->dst)) {
+            out.emplace_back(ASMTree::Mov(std::move(b->src), ASMTree::Reg::reg::R10, b->loc));
+            out.emplace_back(ASMTree::Binary(b->op, ASMTree::Reg::reg::R10, std::move(b->dst), b->loc));
+        } else if (auto* d = std::get_if<ASMTree::Idiv>(&instr); d && std::holds_alternative<ASMTree::Imm>(d->operand)) {
+            out.emplace_back(ASMTree::Mov(std::move(d->operand), ASMTree::Reg::reg::R10, d->loc));
+            out.emplace_back(ASMTree::Idiv(ASMTree::Reg::reg::R10, d->loc));
+        } else if (auto* w = std::get_if<ASMTree::WideMul>(&instr); w && std::holds_alternative<ASMTree::Imm>(w->operand)) {
+            out.emplace_back(ASMTree::Mov(std::move(w->operand), ASMTree::Reg::reg::R10, w->loc));
+            out.emplace_back(ASMTree::WideMul(ASMTree::Reg::reg::R10, w->loc));
+        } else {
+            out.push_back(std::move(instr));
+        }
+    };
+    return l;
+}
+
+// Inlines every call into f whose callee is already finished and cheap
+// enough. Blocks cloned from a callee hold only the calls it kept, which
+// are never worth another look, so only the blocks f started with are
+// searched.
+void inline_calls(TAC::Function& f, const std::unordered_map<std::string, const TAC::Function*>& finished,
+        const Passes::Options& opts, int& inlined) {
+    size_t num_blocks = f.blocks.size();
+    std::vector<std::pair<size_t, const TAC::Function*>> calls;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        calls.clear();
+        const auto& code = f.blocks[b].instructions;
+        for (size_t idx = 0; idx < code.size(); ++idx) {
+            const auto* c = std::get_if<TAC::FunCall>(&code[idx]);
+            auto it = c ? finished.find(c->name) : finished.end();
+            if (it != finished.end() && inline_cost(*it->second, c->args) <= inline_threshold(c->name, opts)) {
+                calls.emplace_back(idx, it->second);
+            }
+        }
+
+        if (!calls.empty()) {
+            inline_block(f, b, calls, inlined);
+        }
+    }
+}
+
+void Passes::optimize(TAC::Program& p, const Passes::Options& opts) {
+    optimize(p, opts, {});
+}
+
+void Passes::optimize(TAC::Program& p, const Passes::Options& opts, 
+        std::unordered_map<std::string, const TAC::Function*> finished) {
+    PassManager<TAC::Function, TAC::Instr, TACAnalyses> pm;
+    // dce empties out blocks that only held dead copies so that jumps can
+    // be threaded past them. The first round runs before SSA, while a
+    // branch on a variable set to a constant before a loop or at the end of
+    // its body can still be threaded past, which the phis for the loop's
+    // other variables would prevent. Threading leaves the copy of that
+    // constant dead in turn, so the second round catches the blocks that
+    // become bare jumps.
+    for (int round = 0; round < 2; ++round) {
+        if (round == 1) {
+            pm.add({ "mem2reg", 1, false, nullptr, promote_variables });
+        }
+        pm.add({ "fold-constants", 1, false, nullptr, fold_constants });
+        pm.add({ "dce", 1, false, nullptr, eliminate_dead_code });
+        pm.add({ "thread-jumps", 1, false, nullptr, thread_jumps });
+        pm.add({ "remove-unreachable", 1, false, nullptr, remove_unreachable });
+    }
+    pm.add({ "dce", 1, false, nullptr, eliminate_dead_code });
+
+    // An instrumented build keeps every call, so that the entry counts in
+    // its profile cover the calls that inlining would have hidden
+    bool inlining = opts.enabled("inline", 2) && opts.profile_generate.empty();
+    int inlined {};
+
+    // Callees are optimized before their callers, so inlining copies their
+    // optimized bodies and the cost model sees their final size. Functions
+    // in the same component call each other and are never inlined there.
+    for (const auto& component : BottomUp(call_graph(p)).order) {
+        for (size_t idx : component) {
+            TAC::Function& f = p.functions[idx];
+            CFG::mark_origins(f);
+            if (inlining) {
+                inline_calls(f, finished, opts, inlined);
+            }
+
+            TACAnalyses analyses;
+            pm.run(f, analyses, opts);
+        }
+
+        for (size_t idx : component) {
+            finished.emplace(p.functions[idx].identifier, &p.functions[idx]);
+        }
+    }
+}
+
+void Passes::optimize(ASMTree::Function& f, const Passes::Options& opts) {
+    bool reuse = opts.enabled("reuse-slots", 2);
+
+    PassManager<std::vector<ASMTree::Instr>, ASMTree::Instr, ASMAnalyses> pm;
+    pm.add({ "allocate-stack", 0, true,
+        [reuse](const std::vector<ASMTree::Instr>& code, ASMAnalyses& analyses) -> Local<ASMTree::Instr> {
+            return allocate_stack(code, analyses, reuse);
+        }, nullptr });
+    pm.add({ "drop-self-moves", 1, false, drop_self_moves, nullptr });
+    pm.add({ "fix-operands", 0, true, fix_invalid_operands, nullptr });
+
+    ASMAnalyses analyses;
+    pm.run(f.instructions, analyses, opts);
+}
@@ -0,0 +1,48 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <optional>
+#include "tac.hpp"
+#include "asmtree.hpp"
+#include "profile.hpp"
+
+namespace Passes {
+    struct Options {
+        int level;
+        std::unordered_map<std::string, bool> overrides;
+        // Largest growth, in TAC instructions, that inlining a call may cost
+        int inline_threshold;
+
+        // Where an instrumented program writes its counts, empty when
+        // not instrumenting
+        std::string profile_generate;
+        std::string profile_use;
+        // The counts read from profile_use, which set the inlining
+        // threshold per callee and which successor layout-blocks puts next
+        std::optional<Profile::Data> profile;
+
+        Options();
+
+        // Accepts -O0, -O1, -O2, -f<pass>, -fno-<pass>, -finline-threshold=N,
+        // -fprofile-generate[=path] and -fprofile-use[=path]
+        bool parse(std::string_view arg);
+
+        bool enabled(const std::string& name, int min_level) const;
+    };
+
+    void optimize(TAC::Program& p, const Options& opts);
+
+    // Optimizes some of a file's functions, where finished holds the rest,
+    // already optimized, for inlining from
+    void optimize(TAC::Program& p, const Options& opts, 
+        std::unordered_map<std::string, const TAC::Function*> finished);
+
+    // Runs the ASMTree pipeline, including the mandatory stack
+    // allocation and instruction fixups
+    void optimize(ASMTree::Function& f, const Options& opts);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+#include "profile.hpp"
+
+uint64_t Profile::Data::count(const std::string& counter) const {
+    auto it = counts.find(counter);
+    return it == counts.end() ? 0 : it->second;
+}
+
+std::string Profile::function_counter(const std::string& function) {
+    return function;
+}
+
+std::string Profile::block_counter(const std::string& function, uint64_t shape, size_t block) {
+    std::ostringstream name;
+    name << function << "." << std::hex << shape << std::dec << "." << block;
+    return name.str();
+}
+
+std::optional<Profile::Data> Profile::read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return std::nullopt;
+    }
+
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string bytes = buffer.str();
+
+    uint64_t num_counters {};
+    uint64_t names_size {};
+    size_t header = sizeof(MAGIC) + 2 * sizeof(uint64_t);
+
+    if (bytes.size() < header || std::memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return std::nullopt;
+    }
+    std::memcpy(&num_counters, bytes.data() + sizeof(MAGIC), sizeof(uint64_t));
+    std::memcpy(&names_size, bytes.data() + sizeof(MAGIC) + sizeof(uint64_t), sizeof(uint64_t));
+
+    if (names_size > bytes.size() - header ||
+            num_counters > (bytes.size() - header - names_size) / sizeof(uint64_t)) {
+        return std::nullopt;
+    }
+
+    Profile::Data data {};
+    size_t name_at = header;
+    size_t count_at = header + names_size;
+
+    for (uint64_t idx = 0; idx < num_counters; ++idx) {
+        size_t end = bytes.find('\0', name_at);
+        if (end == std::string::npos || end >= header + names_size) {
+            return std::nullopt;
+        }
+
+        uint64_t count {};
+        std::memcpy(&count, bytes.data() + count_at + idx * sizeof(uint64_t), sizeof(uint64_t));
+        data.counts[bytes.substr(name_at, end - name_at)] += count;
+
+        name_at = end + 1;
+    }
+
+    // Only the function counters are named without a block
+    for (const auto& [name, count] : data.counts) {
+        if (name.find('.') == std::string::npos) {
+            data.hottest_function = std::max(data.hottest_function, count);
+        }
+    }
+
+    return data;
+}
@@ -0,0 +1,38 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+
+// Execution counts gathered by -fprofile-generate builds. The instrumented
+// program writes, at exit:
+//   char magic[8]
+//   uint64_t num_counters
+//   uint64_t names_size
+//   char names[names_size]      NUL-terminated counter names, in order
+//   uint64_t counts[num_counters]
+namespace Profile {
+    static constexpr char MAGIC[8] = { 'T', 'T', 'C', 'P', 'R', 'O', 'F', '1' };
+    static constexpr const char* DEFAULT_PATH = "ttc.prof";
+
+    struct Data {
+        std::unordered_map<std::string, uint64_t> counts;
+        // The highest count of entries into any one function
+        uint64_t hottest_function;
+
+        uint64_t count(const std::string& counter) const;
+    };
+
+    // Counter naming shared by the instrumentation and its consumers. A
+    // block's counter also names the shape of the function's control flow
+    // graph, so counts only match blocks numbered the same way.
+    std::string function_counter(const std::string& function);
+    std::string block_counter(const std::string& function, uint64_t shape, size_t block);
+
+    std::optional<Data> read(const std::string& path);
+}
+
+#endif
@@ -9,15 +9,108 @@ TAC::Var::Var(std::string identifier) : identifier(std::move(identifier)) {}
 
 using Val = std::variant<std::monostate, TAC::Constant, TAC::Var>;
 
-TAC::Return::Return(TAC::Val val) : val(std::move(val)) {}
+TAC::Return::Return(TAC::Val val, Location loc) : val(std::move(val)), loc(loc) {}
 
-TAC::Unary::Unary(TAC::Unary::UnOp op, TAC::Val src, TAC::Var dst) : op(op), src(std::move(src)), dst(std::move(dst)) {}
+TAC::Unary::Unary(TAC::Unary::UnOp op, TAC::Val src, TAC::Var dst, Location loc) : 
+    op(op), src(std::move(src)), dst(std::move(dst)), loc(loc) {}
 
-using Instr = std::variant<std::monostate, TAC::Return, TAC::Unary>;
+TAC::Binary::Binary(TAC::Binary::BinOp op, TAC::Val src1, TAC::Val src2, TAC::Var dst, Location loc) : 
+    op(op), src1(std::move(src1)), src2(std::move(src2)), dst(std::move(dst)), loc(loc) {}
 
-TAC::Function::Function(std::string identifier) : identifier(std::move(identifier)), instructions(0) {}
+TAC::Copy::Copy(TAC::Val src, TAC::Var dst, Location loc) : 
+    src(std::move(src)), dst(std::move(dst)), loc(loc) {}
 
-TAC::Program::Program(Function f) : f(std::move(f)) {}
+TAC::FunCall::FunCall(std::string name, std::vector<TAC::Val> args, TAC::Var dst, Location loc) : 
+    name(std::move(name)), args(std::move(args)), dst(std::move(dst)), loc(loc) {}
+
+TAC::Jump::Jump(size_t target, Location loc) : target(target), loc(loc) {}
+
+TAC::Branch::Branch(TAC::Val cond, size_t if_true, size_t if_false, Location loc) : 
+    cond(std::move(cond)), if_true(if_true), if_false(if_false), loc(loc) {}
+
+TAC::Phi::Phi(std::vector<std::pair<size_t, TAC::Val>> incoming, TAC::Var dst, Location loc) : 
+    incoming(std::move(incoming)), dst(std::move(dst)), loc(loc) {}
+
+using Instr = std::variant<std::monostate, TAC::Return, TAC::Unary, TAC::Binary, TAC::Copy, TAC::FunCall, TAC::Jump, TAC::Branch, TAC::Phi>;
+
+bool TAC::is_terminator(const TAC::Instr& i) {
+    return std::holds_alternative<TAC::Return>(i) || std::holds_alternative<TAC::Jump>(i) || 
+        std::holds_alternative<TAC::Branch>(i);
+}
+
+std::vector<const TAC::Val*> TAC::sources(const TAC::Instr& i) {
+    std::vector<const TAC::Val*> srcs;
+    if (const auto* r = std::get_if<TAC::Return>(&i)) {
+        srcs.push_back(&r->val);
+    } else if (const auto* u = std::get_if<TAC::Unary>(&i)) {
+        srcs.push_back(&u->src);
+    } else if (const auto* b = std::get_if<TAC::Binary>(&i)) {
+        srcs.push_back(&b->src1);
+        srcs.push_back(&b->src2);
+    } else if (const auto* c = std::get_if<TAC::Copy>(&i)) {
+        srcs.push_back(&c->src);
+    } else if (const auto* call = std::get_if<TAC::FunCall>(&i)) {
+        for (const auto& arg : call->args) {
+            srcs.push_back(&arg);
+        }
+    } else if (const auto* br = std::get_if<TAC::Branch>(&i)) {
+        srcs.push_back(&br->cond);
+    } else if (const auto* phi = std::get_if<TAC::Phi>(&i)) {
+        for (const auto& in : phi->incoming) {
+            srcs.push_back(&in.second);
+        }
+    }
+    return srcs;
+}
+
+std::vector<TAC::Val*> TAC::sources(TAC::Instr& i) {
+    std::vector<TAC::Val*> srcs;
+    for (const auto* src : sources(static_cast<const TAC::Instr&>(i))) {
+        srcs.push_back(const_cast<TAC::Val*>(src));
+    }
+    return srcs;
+}
+
+const TAC::Var* TAC::destination(const TAC::Instr& i) {
+    if (const auto* u = std::get_if<TAC::Unary>(&i)) {
+        return &u->dst;
+    }
+    if (const auto* b = std::get_if<TAC::Binary>(&i)) {
+        return &b->dst;
+    }
+    if (const auto* c = std::get_if<TAC::Copy>(&i)) {
+        return &c->dst;
+    }
+    if (const auto* call = std::get_if<TAC::FunCall>(&i)) {
+        return &call->dst;
+    }
+    if (const auto* phi = std::get_if<TAC::Phi>(&i)) {
+        return &phi->dst;
+    }
+    return nullptr;
+}
+
+TAC::Var* TAC::destination(TAC::Instr& i) {
+    return const_cast<TAC::Var*>(destination(static_cast<const TAC::Instr&>(i)));
+}
+
+std::vector<size_t> TAC::successors(const TAC::Block& b) {
+    if (b.instructions.empty()) {
+        return {};
+    }
+    if (const auto* j = std::get_if<TAC::Jump>(&b.instructions.back())) {
+        return { j->target };
+    }
+    if (const auto* br = std::get_if<TAC::Branch>(&b.instructions.back())) {
+        return { br->if_true, br->if_false };
+    }
+    return {};
+}
+
+TAC::Function::Function(std::string identifier, std::vector<std::string> params, Location loc) : 
+    identifier(std::move(identifier)), params(std::move(params)), loc(loc) {}
+
+TAC::Program::Program(std::vector<Function> functions) : functions(std::move(functions)) {}
 
 std::string make_temp() {
     static int counter {};
@@ -31,26 +124,144 @@ TAC::Unary::UnOp convert_unop(const AST::Unary::UnOp unop) {
             return TAC::Unary::UnOp::NEGATE;
         case AST::Unary::UnOp::TILDE:
             return TAC::Unary::UnOp::COMPLEMENT;
+        case AST::Unary::UnOp::NOT:
+            return TAC::Unary::UnOp::NOT;
         default: // satisfy compiler warning - should never execute
             return TAC::Unary::UnOp::NEGATE;
     }
 }
 
+// Only called for the operators that evaluate both sides unconditionally
+TAC::Binary::BinOp convert_binop(const AST::Binary::BinOp binop) {
+    switch (binop) {
+        case AST::Binary::BinOp::ADD: return TAC::Binary::BinOp::ADD;
+        case AST::Binary::BinOp::SUB: return TAC::Binary::BinOp::SUBTRACT;
+        case AST::Binary::BinOp::MUL: return TAC::Binary::BinOp::MULTIPLY;
+        case AST::Binary::BinOp::DIV: return TAC::Binary::BinOp::DIVIDE;
+        case AST::Binary::BinOp::MOD: return TAC::Binary::BinOp::REMAINDER;
+        case AST::Binary::BinOp::LT: return TAC::Binary::BinOp::LESS;
+        case AST::Binary::BinOp::LE: return TAC::Binary::BinOp::LESS_EQUAL;
+        case AST::Binary::BinOp::GT: return TAC::Binary::BinOp::GREATER;
+        case AST::Binary::BinOp::GE: return TAC::Binary::BinOp::GREATER_EQUAL;
+        case AST::Binary::BinOp::EQ: return TAC::Binary::BinOp::EQUAL;
+        case AST::Binary::BinOp::NE: return TAC::Binary::BinOp::NOT_EQUAL;
+        default: // satisfy compiler warning - should never execute
+            return TAC::Binary::BinOp::ADD;
+    }
+}
+
 template<class... Ts> struct overloaded : Ts... { 
     using Ts::operator()...; 
 };
 
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-TAC::Val emit_tac(const AST::Expr& exp, std::vector<TAC::Instr>& instructions) {
+// Appends to the current block of the function being emitted. Code after a
+// terminator is unreachable from it, so it opens a fresh block, but only once
+// something actually follows.
+class Builder {
+    TAC::Function& f;
+    size_t current;
+    bool terminated;
+
+public:
+    Builder(TAC::Function& f) : f(f), current(new_block()), terminated(false) {}
+
+    size_t new_block() {
+        f.blocks.emplace_back();
+        return f.blocks.size() - 1;
+    }
+
+    void start(size_t block) {
+        current = block;
+        terminated = false;
+    }
+
+    bool is_terminated() const {
+        return terminated;
+    }
+
+    // Jumps to target unless the current block already ended, in which
+    // case control cannot get here to jump anywhere
+    void jump(size_t target, Location loc) {
+        if (!terminated) {
+            emit<TAC::Jump>(target, loc);
+        }
+    }
+
+    template <typename T, typename... Args>
+    void emit(Args&&... args) {
+        if (terminated) {
+            start(new_block());
+        }
+        f.blocks[current].instructions.emplace_back(std::in_place_type<T>, std::forward<Args>(args)...);
+        terminated = TAC::is_terminator(f.blocks[current].instructions.back());
+    }
+};
+
+TAC::Val emit_tac(const AST::Expr& exp, Builder& b) {
     return std::visit(
         overloaded {
             [](const AST::Constant& c) -> TAC::Val { return TAC::Constant(c.val); },
-            [&instructions](const AST::Unary& u) -> TAC::Val { 
-                TAC::Val src = ::emit_tac(*u.exp, instructions);
+            [](const AST::Var& v) -> TAC::Val { return TAC::Var(v.name); },
+            [&b](const AST::Unary& u) -> TAC::Val { 
+                TAC::Val src = ::emit_tac(*u.exp, b);
                 TAC::Var dst = TAC::Var(make_temp());
                 TAC::Unary::UnOp op = convert_unop(u.op);
-                instructions.emplace_back(std::in_place_type<TAC::Unary>, op, src, dst);
+                b.emit<TAC::Unary>(op, std::move(src), dst, u.loc);
+                return dst;
+            },
+            [&b](const AST::Binary& bin) -> TAC::Val {
+                if (bin.op != AST::Binary::BinOp::AND && bin.op != AST::Binary::BinOp::OR) {
+                    TAC::Val src1 = ::emit_tac(*bin.lhs, b);
+                    TAC::Val src2 = ::emit_tac(*bin.rhs, b);
+                    TAC::Var dst = TAC::Var(make_temp());
+                    b.emit<TAC::Binary>(convert_binop(bin.op), std::move(src1), std::move(src2), dst, bin.loc);
+                    return dst;
+                }
+
+                // rhs only runs when lhs does not decide the result: when
+                // it is nonzero for &&, and when it is zero for ||
+                bool is_and = bin.op == AST::Binary::BinOp::AND;
+                size_t rhs = b.new_block();
+                size_t decided = b.new_block();
+                size_t undecided = b.new_block();
+                size_t end = b.new_block();
+
+                TAC::Val lhs_val = ::emit_tac(*bin.lhs, b);
+                b.emit<TAC::Branch>(std::move(lhs_val), is_and ? rhs : decided, is_and ? decided : rhs, bin.loc);
+
+                b.start(rhs);
+                TAC::Val rhs_val = ::emit_tac(*bin.rhs, b);
+                b.emit<TAC::Branch>(std::move(rhs_val), is_and ? undecided : decided, is_and ? decided : undecided, bin.loc);
+
+                TAC::Var dst = TAC::Var(make_temp());
+                b.start(decided);
+                b.emit<TAC::Copy>(TAC::Constant(is_and ? 0 : 1), dst, bin.loc);
+                b.jump(end, bin.loc);
+
+                b.start(undecided);
+                b.emit<TAC::Copy>(TAC::Constant(is_and ? 1 : 0), dst, bin.loc);
+                b.jump(end, bin.loc);
+
+                b.start(end);
+                return dst;
+            },
+            [&b](const AST::Assignment& a) -> TAC::Val {
+                TAC::Val src = ::emit_tac(*a.rhs, b);
+                TAC::Var dst = TAC::Var(std::get<AST::Var>(*a.lhs).name);
+                b.emit<TAC::Copy>(std::move(src), dst, a.loc);
+                return dst;
+            },
+            [&b](const AST::FunctionCall& c) -> TAC::Val {
+                std::vector<TAC::Val> args;
+                args.reserve(c.args.size());
+                for (const auto& arg : c.args) {
+                    args.push_back(::emit_tac(*arg, b));
+                }
+
+                TAC::Var dst = TAC::Var(make_temp());
+                b.emit<TAC::FunCall>(c.name, std::move(args), dst, c.loc);
                 return dst;
             },
             [](const std::monostate&) -> TAC::Val { return std::monostate{}; }
@@ -58,22 +269,109 @@ TAC::Val emit_tac(const AST::Expr& exp, std::vector<TAC::Instr>& instructions) {
     );
 }
 
-TAC::Function emit_tac(const AST::Function& f) {
-    TAC::Function tac_f = TAC::Function(f.name);
+void emit_tac(const AST::BlockItem& item, Builder& b);
 
+void emit_tac(const AST::Stmt& s, Builder& b) {
     std::visit(
         overloaded {
-            [&tac_f](const AST::Return& r) -> void {
-                tac_f.instructions.emplace_back(std::in_place_type<TAC::Return>, ::emit_tac(r.exp, tac_f.instructions));
+            [&b](const AST::Return& r) -> void {
+                TAC::Val val = ::emit_tac(r.exp, b);
+                b.emit<TAC::Return>(std::move(val), r.loc);
+            },
+            [&b](const AST::Expression& e) -> void {
+                ::emit_tac(e.exp, b);
+            },
+            [&b](const AST::If& i) -> void {
+                size_t then = b.new_block();
+                size_t otherwise = i.otherwise ? b.new_block() : 0;
+                size_t end = b.new_block();
+
+                TAC::Val cond = ::emit_tac(i.cond, b);
+                b.emit<TAC::Branch>(std::move(cond), then, i.otherwise ? otherwise : end, i.loc);
+
+                b.start(then);
+                ::emit_tac(*i.then, b);
+                b.jump(end, i.loc);
+
+                if (i.otherwise) {
+                    b.start(otherwise);
+                    ::emit_tac(*i.otherwise, b);
+                    b.jump(end, i.loc);
+                }
+
+                b.start(end);
+            },
+            [&b](const AST::While& w) -> void {
+                size_t header = b.new_block();
+                size_t body = b.new_block();
+                size_t end = b.new_block();
+
+                b.jump(header, w.loc);
+
+                b.start(header);
+                TAC::Val cond = ::emit_tac(w.cond, b);
+                b.emit<TAC::Branch>(std::move(cond), body, end, w.loc);
+
+                b.start(body);
+                ::emit_tac(*w.body, b);
+                b.jump(header, w.loc);
+
+                b.start(end);
+            },
+            [&b](const AST::Compound& c) -> void {
+                for (const auto& item : c.items) {
+                    ::emit_tac(item, b);
+                }
             },
+            [](const auto&) -> void {}
+        }, s
+    );
+}
+
+void emit_tac(const AST::Declaration& d, Builder& b) {
+    if (d.init) {
+        TAC::Val src = ::emit_tac(*d.init, b);
+        b.emit<TAC::Copy>(std::move(src), TAC::Var(d.name), d.loc);
+    }
+}
+
+void emit_tac(const AST::BlockItem& item, Builder& b) {
+    std::visit(
+        overloaded {
+            [&b](const AST::Stmt& s) -> void { ::emit_tac(s, b); },
+            [&b](const AST::Declaration& d) -> void { ::emit_tac(d, b); },
             [](const std::monostate&) -> void {}
-        }, f.body
+        }, item
     );
+}
+
+TAC::Function emit_tac(AST::Function&& f) {
+    TAC::Function tac_f = TAC::Function(std::move(f.name), std::move(f.params), f.loc);
+    Builder b = Builder(tac_f);
+
+    for (const auto& item : *f.body) {
+        ::emit_tac(item, b);
+    }
+
+    // Falling off the end of a function returns 0, which is what C
+    // requires of main
+    if (!b.is_terminated()) {
+        b.emit<TAC::Return>(TAC::Constant(0), f.loc);
+    }
 
     return tac_f;
 }
 
-TAC::Program TAC::emit_tac(const AST::Program& p) {
-    TAC::Function tac_func = ::emit_tac(p.func_def);
-    return TAC::Program(std::move(tac_func));
+TAC::Program TAC::emit_tac(AST::Program&& p) {
+    // Take ownership so the AST is freed as soon as emission is done
+    AST::Program ast = std::move(p);
+
+    std::vector<TAC::Function> functions;
+    for (auto& f : ast.functions) {
+        if (f.body) {
+            functions.push_back(::emit_tac(std::move(f)));
+        }
+    }
+
+    return TAC::Program(std::move(functions));
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <string>
 #include <variant>
 #include <vector>
+#include <utility>
+#include <optional>
+#include <cstdint>
 #include "ast.hpp"
 
 namespace TAC {
@@ -22,35 +25,138 @@ namespace TAC {
 
     struct Return {
         Val val;
+        Location loc;
 
-        Return(Val val);
+        Return(Val val, Location loc);
     };
 
     struct Unary {
-        enum class UnOp { COMPLEMENT, NEGATE };
+        enum class UnOp { COMPLEMENT, NEGATE, NOT };
         
         UnOp op;
         Val src;
         Var dst;
+        Location loc;
 
-        Unary(UnOp op, Val src, Var dst);
+        Unary(UnOp op, Val src, Var dst, Location loc);
     };
 
-    using Instr = std::variant<std::monostate, Return, Unary>;
+    // Relational operators produce 1 when they hold and 0 otherwise
+    struct Binary {
+        enum class BinOp { 
+            ADD, SUBTRACT, MULTIPLY, DIVIDE, REMAINDER, 
+            EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL 
+        };
+
+        BinOp op;
+        Val src1;
+        Val src2;
+        Var dst;
+        Location loc;
+
+        Binary(BinOp op, Val src1, Val src2, Var dst, Location loc);
+    };
+
+    struct Copy {
+        Val src;
+        Var dst;
+        Location loc;
+
+        Copy(Val src, Var dst, Location loc);
+    };
+
+    struct FunCall {
+        std::string name;
+        std::vector<Val> args;
+        Var dst;
+        Location loc;
+
+        FunCall(std::string name, std::vector<Val> args, Var dst, Location loc);
+    };
+
+    // Targets are indices into the function's blocks
+    struct Jump {
+        size_t target;
+        Location loc;
+
+        Jump(size_t target, Location loc);
+    };
+
+    // Goes to if_true when cond is nonzero and to if_false otherwise
+    struct Branch {
+        Val cond;
+        size_t if_true;
+        size_t if_false;
+        Location loc;
+
+        Branch(Val cond, size_t if_true, size_t if_false, Location loc);
+    };
+
+    // Takes the value listed for whichever block control came from. A
+    // block's phis come before all its other instructions, and read their
+    // sources together before any of them is assigned.
+    struct Phi {
+        std::vector<std::pair<size_t, Val>> incoming;
+        Var dst;
+        Location loc;
+
+        Phi(std::vector<std::pair<size_t, Val>> incoming, Var dst, Location loc);
+    };
+
+    using Instr = std::variant<std::monostate, Return, Unary, Binary, Copy, FunCall, Jump, Branch, Phi>;
+
+    // Return, Jump and Branch end a block, and nothing else may
+    bool is_terminator(const Instr& i);
+
+    // The values i reads, in order
+    std::vector<const Val*> sources(const Instr& i);
+    std::vector<Val*> sources(Instr& i);
+
+    // The variable i assigns, or null
+    const Var* destination(const Instr& i);
+    Var* destination(Instr& i);
+
+    // Where a block came from: its number in the function it was first
+    // emitted in, whose control flow then had the given shape (see
+    // CFG::shape). Profile counts are kept by origin, so they find their
+    // blocks again in a build that optimized or inlined differently.
+    struct Origin {
+        std::string function;
+        uint64_t shape;
+        size_t block;
+    };
+
+    // A straight-line run of instructions ending in its only terminator,
+    // whose targets are the block's successor edges
+    struct Block {
+        std::vector<Instr> instructions;
+        // Set by Passes::optimize before any pass runs, and absent for the
+        // blocks passes add
+        std::optional<Origin> origin;
+    };
+
+    std::vector<size_t> successors(const Block& b);
 
     struct Function {
         std::string identifier;
-        std::vector<Instr> instructions;
+        std::vector<std::string> params;
+        // Execution starts at blocks[0]
+        std::vector<Block> blocks;
+        Location loc;
 
-        Function(std::string identifier);
+        Function(std::string identifier, std::vector<std::string> params, Location loc);
     };
 
+    // Only functions defined in this file are listed; calls to anything
+    // else are resolved by the linker
     struct Program {
-        Function f;
+        std::vector<Function> functions;
+        // Path of the source file, for debug info
+        std::string source;
 
-        Program(Function f);
+        Program(std::vector<Function> functions);
     };
 
-    Program emit_tac(const AST::Program& p);
+    Program emit_tac(AST::Program&& p);
 }
 #endif
\ No newline at end of file
@@ -3,56 +3,364 @@
 #include <memory>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <stdexcept>
+#include <algorithm>
 #include "lexer.hpp"
 #include "ast.hpp"
 #include "tac.hpp"
+#include "lineartac.hpp"
 #include "asmtree.hpp"
+#include "passes.hpp"
 #include "codegen.hpp"
+#include "driver.hpp"
+#include "interpreter.hpp"
+#include "profile.hpp"
+#include "cfg.hpp"
+#include "watch.hpp"
+#include "diagnostics.hpp"
+
+struct Options {
+    std::vector<std::string> inputs;
+    std::string output;
+    Driver::Mode mode = Driver::Mode::EXECUTABLE;
+    std::string emit_tac;
+    bool from_tac = false;
+    bool debug = false;
+    bool eval = false;
+    bool difftest = false;
+    bool watch = false;
+    Diagnostics::Format diagnostics_format = Diagnostics::Format::TEXT;
+    // Errors printed at most, 0 printing all of them
+    size_t error_limit = 20;
+    Passes::Options passes;
+};
+
+void usage() {
+    std::cout << "Usage: ./ttc.exe [-S|-c] [-g] [-o <output>] [-O0|-O1|-O2] [-f[no-]<pass>]" << "\n";
+    std::cout << "                 [-finline-threshold=<n>] [-fprofile-generate[=<path>]]" << "\n";
+    std::cout << "                 [-fprofile-use[=<path>]] [-ferror-limit=<n>]" << "\n";
+    std::cout << "                 [-fdiagnostics-format=text|json] [filename]" << "\n";
+    std::cout << "       ./ttc.exe --emit-tac <output> [filename]" << "\n";
+    std::cout << "       ./ttc.exe [-S|-c] [-g] [-o <output>] [-O0|-O1|-O2] [-f[no-]<pass>] --from-tac <filename>" << "\n";
+    std::cout << "       ./ttc.exe --eval [-O0|-O1|-O2] [filename]" << "\n";
+    std::cout << "       ./ttc.exe --difftest [-O0|-O1|-O2] [filenames...]" << "\n";
+    std::cout << "       ./ttc.exe --watch [-S|-c] [-g] [-o <output>] [-O0|-O1|-O2] [-f[no-]<pass>] [filename]" << "\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options opts;
+    static constexpr std::string_view limit_flag = "-ferror-limit=";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "-S") {
+            opts.mode = Driver::Mode::ASSEMBLY;
+        } else if (arg == "-c") {
+            opts.mode = Driver::Mode::OBJECT;
+        } else if (arg == "-g") {
+            opts.debug = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (arg == "--emit-tac" && i + 1 < argc) {
+            opts.emit_tac = argv[++i];
+        } else if (arg == "--from-tac" && i + 1 < argc) {
+            opts.from_tac = true;
+            opts.inputs.push_back(argv[++i]);
+        } else if (arg == "--eval") {
+            opts.eval = true;
+        } else if (arg == "--difftest") {
+            opts.difftest = true;
+        } else if (arg == "--watch") {
+            opts.watch = true;
+        } else if (arg == "-fdiagnostics-format=text" || arg == "-fdiagnostics-format=json") {
+            opts.diagnostics_format = arg.back() == 'n' ? Diagnostics::Format::JSON : Diagnostics::Format::TEXT;
+        } else if (arg.compare(0, limit_flag.size(), limit_flag) == 0) {
+            std::string digits = arg.substr(limit_flag.size());
+            if (digits.empty() || digits.size() > 9 || digits.find_first_not_of("0123456789") != std::string::npos) {
+                return std::nullopt;
+            }
+            opts.error_limit = std::stoul(digits);
+        } else if (opts.passes.parse(arg)) {
+            continue;
+        } else if (arg.empty() || arg[0] == '-') {
+            return std::nullopt;
+        } else {
+            opts.inputs.push_back(arg);
+        }
+    }
+
+    if (opts.inputs.empty() || (!opts.difftest && opts.inputs.size() > 1)) {
+        return std::nullopt;
+    }
+
+    if (opts.from_tac && !opts.emit_tac.empty()) {
+        return std::nullopt;
+    }
+
+    // Profile counters are numbered across the whole program, so an
+    // instrumented build cannot be put together a function at a time
+    if (opts.watch && (opts.from_tac || !opts.emit_tac.empty() || opts.eval || opts.difftest 
+            || !opts.passes.profile_generate.empty())) {
+        return std::nullopt;
+    }
+
+    return opts;
+}
+
+std::optional<LinearTAC::Program> read_linear(const std::string& path) {
+    std::optional<LinearTAC::Program> linear = LinearTAC::read(path);
+
+    if (!linear) {
+        std::cerr << "Error: unable to read TAC file " << path << "\n";
+    }
+
+    return linear;
+}
+
+std::optional<TAC::Program> load_tac(const std::string& path) {
+    std::optional<LinearTAC::Program> linear = read_linear(path);
+
+    if (!linear) {
+        return std::nullopt;
+    }
+
+    return LinearTAC::decode(*linear);
+}
+
+// JSON output stands alone, for tools to read
+void report(const Diagnostics& diagnostics, const Options& opts) {
+    diagnostics.print(std::cerr, opts.diagnostics_format, opts.error_limit);
+    if (opts.diagnostics_format == Diagnostics::Format::TEXT) {
+        std::cerr << "Aborted due to syntax error\n";
+    }
+}
+
+std::optional<TAC::Program> compile_source(const Options& opts, const std::string& path) {
+    std::ifstream input_file(path);
+
+    if (!input_file.is_open()) {
+        std::cerr << "Error: unable to open the file " << path << "\n";
+        return std::nullopt;
+    }
+
+    // Each stage lives in its own scope so that only two adjacent
+    // representations are ever alive at the same time
+    std::optional<AST::Program> ast;
+    Diagnostics diagnostics;
+    {
+        std::vector<Token> tokens;
+        {
+            std::stringstream buffer;
+            buffer << input_file.rdbuf();
+            input_file.close();
+
+            Lexer l = Lexer();
+            tokens = l.read(buffer.str());
+        }
+
+        AST::Parser p = AST::Parser(tokens, diagnostics);
+        ast = p.parse_program();
+    }
+
+    if (!ast) {
+        report(diagnostics, opts);
+        return std::nullopt;
+    }
+
+    TAC::Program tac = TAC::emit_tac(std::move(*ast));
+    tac.source = path;
+    return tac;
+}
+
+// A profile taken from some other program is almost always a mistake,
+// though the code still compiles without it. A function that was
+// profiled but has changed since keeps its entry count but loses its
+// block counts, which layout-blocks then does without.
+void check_profile(const Options& opts, const TAC::Program& tac, const std::string& path) {
+    const Profile::Data& profile = *opts.passes.profile;
+    bool matched = false;
+    for (const auto& f : tac.functions) {
+        if (!profile.counts.count(Profile::function_counter(f.identifier))) {
+            continue;
+        }
+        matched = true;
+
+        uint64_t shape = CFG::shape(CFG::Graph(f));
+        if (!profile.counts.count(Profile::block_counter(f.identifier, shape, 0))) {
+            std::cerr << "Warning: profile " << opts.passes.profile_use << " has no block counts for " 
+                << f.identifier << ", whose control flow has changed since\n";
+        }
+    }
+
+    if (!matched && !tac.functions.empty()) {
+        std::cerr << "Warning: profile " << opts.passes.profile_use << " has no counts for any function in " 
+            << path << "\n";
+    }
+}
+
+// The TAC as emitted, before any pass has run on it
+std::optional<TAC::Program> load(const Options& opts, const std::string& path) {
+    std::optional<TAC::Program> tac = opts.from_tac ? load_tac(path) : compile_source(opts, path);
+
+    if (tac && opts.passes.profile) {
+        check_profile(opts, *tac, path);
+    }
+
+    return tac;
+}
+
+// Checks the native code against the interpreter for every input. The
+// interpreter runs the TAC before optimization, so that a miscompile in a
+// TAC pass shows up as a mismatch instead of on both sides.
+int difftest(const Options& opts) {
+    size_t failures {};
+    size_t skipped {};
+
+    for (const auto& path : opts.inputs) {
+        // The interpreter runs a TAC file's records where they are mapped,
+        // and source once it is encoded
+        std::optional<LinearTAC::Program> linear;
+        std::optional<TAC::Program> tac;
+        if (opts.from_tac) {
+            linear = read_linear(path);
+            if (linear) {
+                tac = LinearTAC::decode(*linear);
+            }
+        } else {
+            tac = compile_source(opts, path);
+            if (tac) {
+                linear = LinearTAC::encode(*tac);
+            }
+        }
+
+        if (!tac) {
+            std::cout << "FAIL " << path << ": does not compile\n";
+            ++failures;
+            continue;
+        }
+
+        // A process only reports the low byte of main's result
+        int expected;
+        try {
+            expected = static_cast<int>(static_cast<unsigned>(Interpreter::run(*linear)) & 0xff);
+        } catch (const std::runtime_error& e) {
+            std::cout << "SKIP " << path << ": " << e.what() << "\n";
+            ++skipped;
+            continue;
+        }
+        linear.reset();
+
+        Passes::optimize(*tac, opts.passes);
+        ASMTree::Program asm_tree = ASMTree::lower(std::move(*tac), opts.passes);
+        tac.reset();
+
+        std::optional<int> actual = Driver::run([&asm_tree](std::ostream& out) -> void {
+            Emitter::emit(asm_tree, out, false);
+        });
+
+        if (!actual || *actual != expected) {
+            std::cout << "FAIL " << path << ": interpreter returned " << expected << ", native ";
+            if (actual) {
+                std::cout << "returned " << *actual << "\n";
+            } else {
+                std::cout << "did not run to completion\n";
+            }
+            ++failures;
+        }
+    }
+
+    std::cout << opts.inputs.size() - failures - skipped << "/" << opts.inputs.size() << " passed";
+    if (skipped) {
+        std::cout << ", " << skipped << " skipped";
+    }
+    std::cout << "\n";
+
+    return failures == 0 ? 0 : 1;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cout << "Usage: ./ttc.exe [filename]" << "\n";
+    std::optional<Options> opts = parse_args(argc, argv);
+
+    if (!opts) {
+        usage();
         return 1;
-    } else {
-        std::ifstream input_file(argv[1]);
+    }
 
-        if (!input_file.is_open()) {
-            std::cerr << "Error: unable to open the file " << argv[1] << "\n";
+    if (!opts->passes.profile_use.empty()) {
+        opts->passes.profile = Profile::read(opts->passes.profile_use);
+
+        if (!opts->passes.profile) {
+            std::cerr << "Error: unable to read profile " << opts->passes.profile_use << "\n";
             return 1;
         }
 
-        std::stringstream buffer;
-        buffer << input_file.rdbuf();
+        // The profile only steers inlining and block layout
+        if (!opts->passes.enabled("inline", 2) && !opts->passes.enabled("layout-blocks", 1)) {
+            std::cerr << "Error: -fprofile-use needs -finline or -flayout-blocks, which -O1 and up enable\n";
+            return 1;
+        }
+    }
+
+    if (opts->difftest) {
+        return difftest(*opts);
+    }
+
+    const std::string& input = opts->inputs.front();
+
+    if (opts->watch) {
+        std::string output = opts->output.empty() ? Driver::default_output(input, opts->mode) : opts->output;
+        return Watch::run(input, output, opts->mode, opts->debug, opts->passes, 
+            opts->diagnostics_format, opts->error_limit);
+    }
+
+    std::optional<TAC::Program> tac = load(*opts, input);
 
-        Lexer l = Lexer();
-        std::vector<Token> tokens = l.read(buffer.str());
-        
-        AST::Parser p = AST::Parser(tokens);
-        std::optional<AST::Program> ast = p.parse_program();
+    if (!tac) {
+        return 1;
+    }
 
-        if (!ast) {
-            std::cerr << "Aborted due to syntax error";
+    // The checkpoint is taken before optimizing, so that resuming from it
+    // runs the passes once, at the level given then
+    if (!opts->emit_tac.empty()) {
+        if (!LinearTAC::write(LinearTAC::encode(*tac), opts->emit_tac)) {
+            std::cerr << "Error: unable to write TAC file " << opts->emit_tac << "\n";
             return 1;
         }
 
-        TAC::Program tac = TAC::emit_tac(*ast);
+        std::cout << "Successfully wrote TAC: " << opts->emit_tac << "\n";
+        return 0;
+    }
 
-        ASMTree::Program asm_tree = ASMTree::lower(tac);
+    Passes::optimize(*tac, opts->passes);
 
-        std::ofstream output_file("main.asm");
-        
-        if (!output_file.is_open()) {
-            std::cerr << "Error: unable to open or create file 'main.asm'";
+    if (opts->eval) {
+        try {
+            std::cout << Interpreter::run(*tac) << "\n";
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << "\n";
             return 1;
         }
+        return 0;
+    }
 
-        Emitter::emit(asm_tree, output_file);
+    ASMTree::Program asm_tree = ASMTree::lower(std::move(*tac), opts->passes);
+    tac.reset();
 
-        std::cout << "Successfully compiled: main.asm\n";
+    std::string output = opts->output.empty() ? Driver::default_output(input, opts->mode) : opts->output;
 
-        output_file.close();
-        input_file.close();
+    auto write = [&asm_tree, debug = opts->debug](std::ostream& out) -> void {
+        Emitter::emit(asm_tree, out, debug);
+    };
 
-        return 0;
+    if (!Driver::build(write, opts->mode, output)) {
+        return 1;
     }
-}
\ No newline at end of file
+
+    std::cout << "Successfully compiled: " << output << "\n";
+
+    return 0;
+}
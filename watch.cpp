@@ -0,0 +1,502 @@
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.hpp"
+#include "codegen.hpp"
+
+Watch::Item::Item(size_t begin, int line, int col, std::vector<Token> tokens) :
+    begin(begin), end(begin), line(line), col(col), end_line(line), end_col(col), tokens(std::move(tokens)),
+    lexed_line(line), signature{0, false}, failed(false), stale(true), parsed_line(line), lowered_line(line) {}
+
+Watch::Session::Session(std::string path, Passes::Options opts, bool debug) :
+    path(std::move(path)), opts(std::move(opts)), debug(debug), compiled(0) {}
+
+// Lexes text as the part of the file starting at offset, on line and col.
+// The returned position is where the text ends.
+std::vector<Token> lex(std::string_view text, size_t offset, int line, int col, Location& end) {
+    end = Location{line, col};
+    if (text.empty()) {
+        return {};
+    }
+
+    std::vector<Token> tokens = Lexer().read(text);
+    for (auto& t : tokens) {
+        if (t.line == 0) {
+            t.col += col;
+        }
+        t.line += line;
+        t.offset += static_cast<int>(offset);
+    }
+
+    end = tokens.back().loc();
+    tokens.pop_back();
+    return tokens;
+}
+
+// Splits tokens into top-level items, each ending at a ';' or '}' outside
+// any braces. Whatever is left over once the tokens run out is an item of
+// its own, which can only fail to parse.
+std::vector<Watch::Item> split(std::vector<Token>&& tokens, size_t end, Location end_loc) {
+    std::vector<Watch::Item> items;
+    std::vector<Token> current;
+    int depth {};
+
+    for (auto& t : tokens) {
+        bool closes = false;
+        if (t.type == TokenType::TOKEN_OPEN_BRACE) {
+            ++depth;
+        } else if (t.type == TokenType::TOKEN_CLOSED_BRACE) {
+            closes = --depth <= 0;
+        } else if (t.type == TokenType::TOKEN_SEMI) {
+            closes = depth == 0;
+        }
+
+        current.push_back(std::move(t));
+        if (!closes) {
+            continue;
+        }
+
+        const Token& first = current.front();
+        const Token& last = current.back();
+        Watch::Item item = Watch::Item(first.offset, first.line, first.col, {});
+        item.end = last.offset + 1;
+        item.end_line = last.line;
+        item.end_col = last.col + 1;
+        item.tokens = std::move(current);
+        items.push_back(std::move(item));
+
+        current.clear();
+        depth = 0;
+    }
+
+    if (!current.empty()) {
+        const Token& first = current.front();
+        Watch::Item item = Watch::Item(first.offset, first.line, first.col, std::move(current));
+        item.end = end;
+        item.end_line = end_loc.line;
+        item.end_col = end_loc.col;
+        items.push_back(std::move(item));
+    }
+
+    return items;
+}
+
+// Fills in the item's name, signature and the functions it calls from its
+// tokens alone, which is all the parse of the items after it needs of it
+void describe(Watch::Item& item) {
+    const auto& t = item.tokens;
+
+    for (size_t idx = 0; idx + 1 < t.size(); ++idx) {
+        if (t[idx].type == TokenType::TOKEN_IDENTIFIER && t[idx + 1].type == TokenType::TOKEN_OPEN_PARAN) {
+            item.calls.push_back(t[idx].lexeme);
+        }
+    }
+
+    if (t.size() < 3 || t[0].type != TokenType::TOKEN_INT || t[1].type != TokenType::TOKEN_IDENTIFIER
+            || t[2].type != TokenType::TOKEN_OPEN_PARAN) {
+        return;
+    }
+
+    item.name = t[1].lexeme;
+    size_t idx = 3;
+    for (; idx < t.size() && t[idx].type != TokenType::TOKEN_CLOSED_PARAN; ++idx) {
+        item.signature.num_params += t[idx].type == TokenType::TOKEN_INT;
+    }
+    item.signature.defined = idx + 1 < t.size() && t[idx + 1].type == TokenType::TOKEN_OPEN_BRACE;
+}
+
+// Records the item's declaration the way the parser would
+void declare(const Watch::Item& item, std::unordered_map<std::string, AST::Parser::Signature>& functions) {
+    if (item.name.empty()) {
+        return;
+    }
+
+    auto [it, inserted] = functions.try_emplace(item.name, AST::Parser::Signature{item.signature.num_params, false});
+    if (inserted || it->second.num_params == item.signature.num_params) {
+        it->second.defined |= item.signature.defined;
+    }
+}
+
+bool same_declarations(const std::vector<Watch::Item>& a, size_t a_first, size_t a_last,
+        const std::vector<Watch::Item>& b) {
+    if (a_last - a_first != b.size()) {
+        return false;
+    }
+
+    for (size_t idx = 0; idx < b.size(); ++idx) {
+        const Watch::Item& x = a[a_first + idx];
+        const Watch::Item& y = b[idx];
+        if (x.name != y.name || x.signature.num_params != y.signature.num_params
+                || x.signature.defined != y.signature.defined) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void move_lines(ASMTree::Function& f, int lines) {
+    f.loc.line += f.loc.line >= 0 ? lines : 0;
+    for (auto& instr : f.instructions) {
+        std::visit([lines](auto& i) -> void {
+            if constexpr (!std::is_same_v<std::decay_t<decltype(i)>, std::monostate>) {
+                i.loc.line += i.loc.line >= 0 ? lines : 0;
+            }
+        }, instr);
+    }
+}
+
+// The item is parsed on its own, knowing only the declarations of the
+// functions it mentions
+bool Watch::Session::parse(Item& item, const std::unordered_map<std::string, AST::Parser::Signature>& functions) {
+    std::vector<Token> tokens = item.tokens;
+    for (auto& t : tokens) {
+        t.line += item.line - item.lexed_line;
+    }
+    tokens.emplace_back(TokenType::TOKEN_EOF, "", item.end_line, item.end_col, static_cast<int>(item.end));
+
+    std::unordered_map<std::string, AST::Parser::Signature> known;
+    for (const auto& name : item.calls) {
+        if (auto it = functions.find(name); it != functions.end()) {
+            known.insert(*it);
+        }
+    }
+
+    AST::Parser p = AST::Parser(tokens, std::move(known), errors);
+    std::optional<AST::Program> ast = p.parse_program();
+    if (!ast) {
+        return false;
+    }
+
+    TAC::Program tac = TAC::emit_tac(std::move(*ast));
+    item.tac.reset();
+    if (!tac.functions.empty()) {
+        item.tac = std::move(tac.functions.front());
+    }
+    item.parsed_line = item.line;
+    return true;
+}
+
+bool Watch::Session::update(std::string text) {
+    compiled = 0;
+    errors.clear();
+
+    // The edit is whatever lies between the longest common prefix and
+    // suffix of the old and new contents
+    size_t limit = std::min(source.size(), text.size());
+    size_t prefix = std::mismatch(source.begin(), source.begin() + limit, text.begin()).first - source.begin();
+    size_t suffix {};
+    while (suffix < limit - prefix && source[source.size() - 1 - suffix] == text[text.size() - 1 - suffix]) {
+        ++suffix;
+    }
+    size_t edit_end = source.size() - suffix;
+
+    // Items wholly before the edit are kept as they are. So are the ones
+    // after it with a line break in between, which therefore keep their
+    // columns and cannot run together with the edited text. Everything
+    // else is lexed again.
+    auto first = std::partition_point(items.begin(), items.end(),
+        [prefix](const Item& item) -> bool { return item.end <= prefix; });
+    size_t newline = source.find('\n', edit_end);
+    auto last = newline == std::string::npos ? items.end() : std::partition_point(first, items.end(),
+        [newline](const Item& item) -> bool { return item.begin <= newline; });
+    size_t first_idx = first - items.begin();
+    size_t last_idx = last - items.begin();
+
+    size_t lo = first_idx > 0 ? items[first_idx - 1].end : 0;
+    size_t old_hi = last_idx < items.size() ? items[last_idx].begin : source.size();
+    size_t hi = old_hi + text.size() - source.size();
+    int line = first_idx > 0 ? items[first_idx - 1].end_line : 0;
+    int col = first_idx > 0 ? items[first_idx - 1].end_col : 0;
+
+    Location end;
+    std::vector<Item> fresh = split(lex(std::string_view(text).substr(lo, hi - lo), lo, line, col, end), hi, end);
+
+    // Edits often leave neighbouring functions untouched, and those keep
+    // what they compiled to
+    std::unordered_map<std::string_view, size_t> replaced;
+    for (size_t idx = first_idx; idx < last_idx; ++idx) {
+        replaced.emplace(std::string_view(source).substr(items[idx].begin, items[idx].end - items[idx].begin), idx);
+    }
+    std::vector<bool> reused(fresh.size());
+    for (size_t k = 0; k < fresh.size(); ++k) {
+        Item& item = fresh[k];
+        describe(item);
+        auto it = replaced.find(std::string_view(text).substr(item.begin, item.end - item.begin));
+        if (it == replaced.end()) {
+            continue;
+        }
+
+        Item& old = items[it->second];
+        if (old.col != item.col || old.failed) {
+            continue;
+        }
+        reused[k] = true;
+        item.stale = old.stale;
+        item.tac = std::move(old.tac);
+        item.parsed_line = old.parsed_line;
+        item.optimized = std::move(old.optimized);
+        item.lowered = std::move(old.lowered);
+        item.lowered_line = old.lowered_line;
+        item.assembly = std::move(old.assembly);
+        replaced.erase(it);
+    }
+
+    // Adding or removing declarations changes what the functions
+    // mentioning them parse to
+    std::unordered_set<std::string> changed;
+    if (!same_declarations(items, first_idx, last_idx, fresh)) {
+        for (size_t idx = first_idx; idx < last_idx; ++idx) {
+            changed.insert(items[idx].name);
+        }
+        for (const auto& item : fresh) {
+            changed.insert(item.name);
+        }
+    }
+
+    int lines = static_cast<int>(std::count(text.begin() + lo, text.begin() + hi, '\n')
+        - std::count(source.begin() + lo, source.begin() + old_hi, '\n'));
+    for (size_t idx = last_idx; idx < items.size(); ++idx) {
+        items[idx].begin += text.size() - source.size();
+        items[idx].end += text.size() - source.size();
+        items[idx].line += lines;
+        items[idx].end_line += lines;
+    }
+
+    size_t num_fresh = fresh.size();
+    if (num_fresh == last_idx - first_idx) {
+        std::move(fresh.begin(), fresh.end(), first);
+    } else {
+        items.erase(first, last);
+        items.insert(items.begin() + first_idx, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    }
+    source = std::move(text);
+
+    // Code inlined into a caller keeps the callee's lines in its debug info,
+    // so moving a function changes the debug info of its callers, which is
+    // only fixed by compiling them again
+    bool inlining = opts.enabled("inline", 2);
+    std::vector<bool> reparse(items.size());
+    std::vector<std::string> worklist;
+    for (size_t idx = 0; idx < items.size(); ++idx) {
+        Item& item = items[idx];
+        bool edited = idx >= first_idx && idx < first_idx + num_fresh && !reused[idx - first_idx];
+        bool affected = !changed.empty() && std::any_of(item.calls.begin(), item.calls.end(),
+            [&changed](const std::string& name) -> bool { return changed.count(name); });
+        bool moved = debug && inlining && item.tac && item.parsed_line != item.line;
+        reparse[idx] = edited || item.failed || affected || moved;
+        if (reparse[idx]) {
+            item.stale = true;
+            if (item.signature.defined) {
+                worklist.push_back(item.name);
+            }
+        }
+    }
+
+    // Inlining copies callees into their callers, which then have to be
+    // compiled again whenever a callee is
+    if (inlining) {
+        worklist.insert(worklist.end(), changed.begin(), changed.end());
+
+        std::unordered_map<std::string, std::vector<size_t>> callers;
+        for (size_t idx = 0; idx < items.size(); ++idx) {
+            for (const auto& name : items[idx].calls) {
+                if (name != items[idx].name) {
+                    callers[name].push_back(idx);
+                }
+            }
+        }
+
+        std::unordered_set<std::string> seen;
+        while (!worklist.empty()) {
+            std::string name = std::move(worklist.back());
+            worklist.pop_back();
+            if (!seen.insert(name).second) {
+                continue;
+            }
+            for (size_t idx : callers[name]) {
+                if (!items[idx].stale) {
+                    items[idx].stale = true;
+                    worklist.push_back(items[idx].name);
+                }
+            }
+        }
+    }
+
+    if (items.empty()) {
+        // Reports the empty file the way a full compile does
+        std::vector<Token> eof = { Token(TokenType::TOKEN_EOF, "", end.line, end.col, static_cast<int>(source.size())) };
+        AST::Parser(eof, errors).parse_program();
+        return false;
+    }
+
+    std::unordered_map<std::string, AST::Parser::Signature> functions;
+    bool ok = true;
+    for (size_t idx = 0; idx < items.size(); ++idx) {
+        Item& item = items[idx];
+        if (reparse[idx]) {
+            item.failed = !parse(item, functions);
+        }
+        ok = ok && !item.failed;
+        declare(item, functions);
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    TAC::Program work = TAC::Program({});
+    std::vector<size_t> work_items;
+    std::unordered_map<std::string, const TAC::Function*> finished;
+    std::unordered_set<std::string> defined;
+    for (size_t idx = 0; idx < items.size(); ++idx) {
+        Item& item = items[idx];
+        if (!item.tac) {
+            continue;
+        }
+        defined.insert(item.name);
+
+        if (item.stale) {
+            work.functions.push_back(*item.tac);
+            work_items.push_back(idx);
+        } else {
+            finished.emplace(item.name, &*item.optimized);
+        }
+    }
+
+    compiled = work_items.size();
+    Passes::optimize(work, opts, std::move(finished));
+    for (size_t k = 0; k < work_items.size(); ++k) {
+        items[work_items[k]].optimized = work.functions[k];
+    }
+
+    ASMTree::Program lowered = ASMTree::lower(std::move(work), opts, defined);
+    for (size_t k = 0; k < work_items.size(); ++k) {
+        Item& item = items[work_items[k]];
+        std::ostringstream out;
+        Emitter::emit(lowered.functions[k], out, debug);
+        item.assembly = out.str();
+        item.lowered_line = item.parsed_line;
+        if (debug) {
+            item.lowered = std::move(lowered.functions[k]);
+        }
+        item.stale = false;
+    }
+
+    // Otherwise only the line numbers in the debug info of moved functions
+    // change, which takes emitting them again but no compiling
+    if (debug) {
+        for (auto& item : items) {
+            if (item.lowered && item.lowered_line != item.line) {
+                move_lines(*item.lowered, item.line - item.lowered_line);
+                item.lowered_line = item.line;
+
+                std::ostringstream out;
+                Emitter::emit(*item.lowered, out, debug);
+                item.assembly = out.str();
+            }
+        }
+    }
+
+    return true;
+}
+
+void Watch::Session::write(std::ostream& out) const {
+    Emitter::begin(path, out, debug);
+    for (const auto& item : items) {
+        out << item.assembly;
+    }
+    Emitter::end(out);
+}
+
+const Diagnostics& Watch::Session::diagnostics() const {
+    return errors;
+}
+
+size_t Watch::Session::recompiled() const {
+    return compiled;
+}
+
+size_t Watch::Session::functions() const {
+    size_t count {};
+    for (const auto& item : items) {
+        count += item.tac.has_value();
+    }
+    return count;
+}
+
+std::optional<std::string> read_file(const std::string& path) {
+    std::ifstream input_file(path);
+
+    if (!input_file.is_open()) {
+        return std::nullopt;
+    }
+
+    std::stringstream buffer;
+    buffer << input_file.rdbuf();
+    return buffer.str();
+}
+
+int Watch::run(const std::string& input, const std::string& output, Driver::Mode mode, bool debug,
+        const Passes::Options& opts, Diagnostics::Format format, size_t error_limit) {
+    // Editors often save by writing a new file and renaming it over the
+    // old one, so it is the directory that is watched
+    size_t slash = input.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : input.substr(0, slash);
+    std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Error: unable to watch " << input << "\n";
+        return 1;
+    }
+
+    Session session = Session(input, opts, debug);
+    alignas(inotify_event) char events[4096];
+
+    while (true) {
+        std::optional<std::string> text = read_file(input);
+        auto start = std::chrono::steady_clock::now();
+
+        if (!text) {
+            std::cerr << "Error: unable to open the file " << input << "\n";
+        } else if (!session.update(std::move(*text))) {
+            session.diagnostics().print(std::cerr, format, error_limit);
+            if (format == Diagnostics::Format::TEXT) {
+                std::cerr << "Aborted due to syntax error\n";
+            }
+        } else if (Driver::build([&session](std::ostream& out) -> void { session.write(out); }, mode, output)) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "Successfully compiled: " << output << " (" << session.recompiled() << " of "
+                << session.functions() << " functions recompiled in " << ms.count() << " ms)\n";
+        }
+        std::cout << std::flush;
+
+        // Waits for the input to be written, taking every event that has
+        // piled up meanwhile in one go
+        bool written = false;
+        while (!written) {
+            ssize_t n = read(fd, events, sizeof(events));
+            if (n <= 0) {
+                std::cerr << "Error: unable to watch " << input << "\n";
+                close(fd);
+                return 1;
+            }
+
+            for (char* p = events; p < events + n;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(p);
+                written |= event->len > 0 && name == event->name;
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+}
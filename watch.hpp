@@ -0,0 +1,97 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <ostream>
+#include "lexer.hpp"
+#include "ast.hpp"
+#include "tac.hpp"
+#include "asmtree.hpp"
+#include "passes.hpp"
+#include "driver.hpp"
+#include "diagnostics.hpp"
+
+// Recompiles a file each time it is saved, redoing only the work the edit
+// affects. The file is kept as the list of its top-level functions, each
+// holding on to its tokens, TAC and assembly from the last compile.
+namespace Watch {
+    struct Item {
+        // Bytes of the source from the first token to just past the closing
+        // ';' or '}', and where the item starts and ends, which is where
+        // lexing picks up again after it
+        size_t begin;
+        size_t end;
+        int line;
+        int col;
+        int end_line;
+        int end_col;
+
+        // As lexed, when the item started on lexed_line
+        std::vector<Token> tokens;
+        int lexed_line;
+
+        // Read off the tokens of `int name(...)`, and empty when they do not
+        // start that way
+        std::string name;
+        AST::Parser::Signature signature;
+        // Every identifier followed by '(', which includes the item's own name
+        std::vector<std::string> calls;
+
+        bool failed;
+        // Left to compile, because it or something it depends on changed
+        bool stale;
+
+        // TAC straight from the parser, when the item started on parsed_line,
+        // and after optimization; neither exists for a prototype
+        std::optional<TAC::Function> tac;
+        int parsed_line;
+        std::optional<TAC::Function> optimized;
+
+        // Kept when emitting debug info, so the assembly can follow the item
+        // when lines above it come or go
+        std::optional<ASMTree::Function> lowered;
+        int lowered_line;
+        std::string assembly;
+
+        Item(size_t begin, int line, int col, std::vector<Token> tokens);
+    };
+
+    class Session {
+        std::string path;
+        Passes::Options opts;
+        bool debug;
+
+        std::string source;
+        std::vector<Item> items;
+        size_t compiled;
+        Diagnostics errors;
+
+        bool parse(Item& item, const std::unordered_map<std::string, AST::Parser::Signature>& functions);
+
+    public:
+        Session(std::string path, Passes::Options opts, bool debug);
+
+        // Brings the program up to date with the new contents of the file,
+        // returning whether it compiles
+        bool update(std::string text);
+
+        void write(std::ostream& out) const;
+
+        // Errors found by the last update
+        const Diagnostics& diagnostics() const;
+
+        // Functions compiled by the last update, and in the whole file
+        size_t recompiled() const;
+
+        size_t functions() const;
+    };
+
+    // Compiles input to output now and after every write to it, until
+    // interrupted
+    int run(const std::string& input, const std::string& output, Driver::Mode mode, bool debug,
+        const Passes::Options& opts, Diagnostics::Format format, size_t error_limit);
+}
+
+#endif